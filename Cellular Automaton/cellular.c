@@ -1,15 +1,27 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 
 bool running = true;
 void sigint_handler(int sig) { running = false; }
 
 // #define PRINT
+// #define STATS // per-generation population, births, deaths and bounding box
+#ifndef STATS_FILE
+#define STATS_FILE "out/stats.csv"
+#endif
+// #define TORUS // edges wrap around instead of reading dead cells past them
 
 #define type bool
 #define ROWS 720
@@ -17,70 +29,2216 @@ void sigint_handler(int sig) { running = false; }
 #define MAX_STEPS 200
 #define SCALE 2
 
-void printGrid(type **grid, int rows, int cols) {
-  for (int i = 0; i < rows; i++)
-    for (int j = 0; j < cols; j++)
-      printf("%s", grid[i][j] ? "[*]" : "[ ]");
+// update kernels
+#define ENGINE_BYTES 0   // one byte per cell, SIMD when available
+#define ENGINE_BITPACK 1 // 64 cells per uint64_t word
+#define ENGINE_ROWSUM 2  // separable sums over a 3-row rolling window
+#define ENGINE_LUT 3     // 4x4 -> 2x2 table lookups on bit-packed rows
+#define ENGINE_HASHLIFE 4 // memoized quadtree, HL_STEP generations per step
+#define ENGINE_TILES 5    // bytes, skipping tiles that did not change
+#define ENGINE_SPARSE 6   // live cells only, for low-density universes
+#define ENGINE_BLOCKED 7  // bytes, TB_DEPTH generations per cache tile
+#define ENGINE_LTL 8      // Larger than Life, radius-R neighborhoods
+#define ENGINE_GENERATIONS 9 // multi-state decay rules on bit planes
+#define ENGINE_MAPPED 10     // bytes, streamed from a file larger than RAM
+#define ENGINE_INPLACE 11    // bytes, one grid and two saved rows
+
+#ifndef ENGINE
+#define ENGINE ENGINE_BYTES
+#endif
+
+// rows are padded to a multiple of GRID_ALIGN bytes
+#ifndef GRID_ALIGN
+#define GRID_ALIGN 64
+#endif
+
+// One contiguous, GRID_ALIGN-aligned block with a one-cell ghost border that
+// reads as dead, or with TORUS holds the opposite edges (see wrapGrid). Cell (i, j) is at
+// cells[i * stride + j] for i in [-1, rows] and j in [-1, cols].
+typedef struct {
+  type *cells;
+  void *block;
+  int rows;
+  int cols;
+  int stride;
+} Grid;
+
+// in 64 bits: rows * stride outgrows int long before it outgrows memory
+#define CELL(g, i, j) ((g)->cells[(int64_t)(i) * (g)->stride + (j)])
+
+void printGrid(Grid *grid) {
+  for (int i = 0; i < grid->rows; i++)
+    for (int j = 0; j < grid->cols; j++)
+      printf("%s", CELL(grid, i, j) ? "[*]" : "[ ]");
   printf("\n");
 
   printf("\n");
 }
 
-int count_neighbors(type **grid, int rows, int cols, int i, int j) {
-  int neighbors = 0;
-  for (int di = -1; di <= 1; di++)
-    for (int dj = -1; dj <= 1; dj++) {
-      int ni = i + di;
-      int nj = j + dj;
-      if (ni < 0 || ni >= rows || nj < 0 || nj >= cols)
-        continue;
-      neighbors += grid[ni][nj];
+// rulestring used unless rule is set at run time, e.g. B36/S23 (HighLife), B2/S (Seeds)
+#ifndef RULE
+#define RULE "B3/S23"
+#endif
+
+// A Life-like rule compiled from its rulestring. table[9 * alive + neighbors]
+// is the next state. The kernels look it up by the 3x3 sum s they compute,
+// cell included: born[s] for dead cells and kept[s] for live ones, padded to
+// 16 entries for byte shuffles, plus the list of sums that set each.
+typedef struct {
+  uint8_t table[18];
+  uint8_t born[16];
+  uint8_t kept[16];
+  uint8_t born_sums[9];
+  uint8_t kept_sums[9];
+  int born_count;
+  int kept_count;
+  bool conway; // B3/S23, which has its own specialized bit-sliced kernel
+} Rule;
+
+Rule rule;
+
+// parses "B3/S23" style rulestrings (either part may come first or be empty)
+bool parseRule(const char *rulestring, Rule *out) {
+  Rule parsed = {{0}};
+  int part = 0;
+  for (const char *c = rulestring; *c; c++) {
+    if (*c == 'B' || *c == 'b')
+      part = 'B';
+    else if (*c == 'S' || *c == 's')
+      part = 'S';
+    else if (*c >= '0' && *c <= '8' && part)
+      parsed.table[(part == 'S') * 9 + *c - '0'] = 1;
+    else if (*c != '/')
+      return false;
+  }
+
+  for (int n = 0; n <= 8; n++) {
+    parsed.born[n] = parsed.table[n];
+    parsed.kept[n + 1] = parsed.table[9 + n];
+    if (parsed.table[n])
+      parsed.born_sums[parsed.born_count++] = n;
+    if (parsed.table[9 + n])
+      parsed.kept_sums[parsed.kept_count++] = n + 1;
+  }
+  parsed.conway = parsed.born_count == 1 && parsed.born_sums[0] == 3 &&
+                  parsed.kept_count == 2 && parsed.kept_sums[0] == 3 &&
+                  parsed.kept_sums[1] == 4;
+  *out = parsed;
+  return true;
+}
+
+// no bounds checks: the ghost border covers i - 1, i + 1, j - 1 and j + 1
+static inline int count_neighbors(const type *up, const type *row,
+                                  const type *down, int j) {
+  return up[j - 1] + up[j] + up[j + 1] + row[j - 1] + row[j] + row[j + 1] +
+         down[j - 1] + down[j] + down[j + 1];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+// One row of the rule on byte cells. The vertical sums of the columns left
+// of, at and right of each cell add up to its 3x3 block, self included, and
+// the next state is looked up from that sum: no branches, one byte a lane.
+// dst must not alias the input rows: a width that is not a multiple of the
+// vector width ends on one vector overlapping the previous one instead of a
+// cell-by-cell tail, which otherwise costs 2-10x per cell on odd widths.
+// When packed is not NULL the new cells also go there as bits, cell j at bit
+// j % 64 of packed[j / 64], taken from the vectors as they are stored, so
+// the row can be hashed (see hash_words) without reading it again.
+typedef void (*RowKernel)(const type *up, const type *row, const type *down,
+                          type *dst, int cols, uint64_t *packed);
+
+// cells [j, cols), word holding the packed cells [j & ~63, j) before them
+static void update_row_from(const type *up, const type *row,
+                            const type *down, type *dst, int j, int cols,
+                            uint64_t word, uint64_t *packed) {
+  for (; j < cols; j++) {
+    dst[j] = rule.table[count_neighbors(up, row, down, j) + 8 * row[j]];
+    word |= (uint64_t)dst[j] << (j & 63);
+    if (packed && (j & 63) == 63) {
+      packed[j >> 6] = word;
+      word = 0;
+    }
+  }
+  if (packed && (cols & 63))
+    packed[cols >> 6] = word;
+}
+
+static void update_row_scalar(const type *up, const type *row,
+                              const type *down, type *dst, int cols,
+                              uint64_t *packed) {
+  update_row_from(up, row, down, dst, 0, cols, 0, packed);
+}
+
+#ifdef X86_SIMD
+__attribute__((target("sse2"))) static inline __m128i
+column_sum_sse2(const type *up, const type *row, const type *down, int j) {
+  return _mm_add_epi8(
+      _mm_add_epi8(_mm_loadu_si128((const __m128i *)(up + j)),
+                   _mm_loadu_si128((const __m128i *)(row + j))),
+      _mm_loadu_si128((const __m128i *)(down + j)));
+}
+
+// SSE2 has no byte shuffle, so the sums of the rule are matched one by one.
+// Returns the new cells as a bit mask.
+__attribute__((target("sse2"))) static inline unsigned
+cells_sse2(const type *up, const type *row, const type *down, type *dst,
+           int j) {
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i sum = _mm_add_epi8(
+      _mm_add_epi8(column_sum_sse2(up, row, down, j - 1),
+                   column_sum_sse2(up, row, down, j)),
+      column_sum_sse2(up, row, down, j + 1));
+  __m128i alive =
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(row + j)), one);
+  __m128i born = _mm_setzero_si128(), kept = _mm_setzero_si128();
+  for (int k = 0; k < rule.born_count; k++)
+    born = _mm_or_si128(born,
+                        _mm_cmpeq_epi8(sum, _mm_set1_epi8(rule.born_sums[k])));
+  for (int k = 0; k < rule.kept_count; k++)
+    kept = _mm_or_si128(kept,
+                        _mm_cmpeq_epi8(sum, _mm_set1_epi8(rule.kept_sums[k])));
+  __m128i live = _mm_or_si128(_mm_andnot_si128(alive, born),
+                              _mm_and_si128(alive, kept));
+  _mm_storeu_si128((__m128i *)(dst + j), _mm_and_si128(live, one));
+  return _mm_movemask_epi8(live);
+}
+
+// The last, overlapping vector repeats cells below j; only its top cols - j
+// mask bits are new.
+__attribute__((target("sse2"))) static void
+update_row_sse2(const type *up, const type *row, const type *down, type *dst,
+                int cols, uint64_t *packed) {
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 16 <= cols; j += 16) {
+    word |= (uint64_t)cells_sse2(up, row, down, dst, j) << (j & 63);
+    if (packed && (j & 63) == 48) {
+      packed[j >> 6] = word;
+      word = 0;
     }
-  return neighbors;
+  }
+  if (j < cols && cols >= 16) {
+    const unsigned mask = cells_sse2(up, row, down, dst, cols - 16);
+    word |= (uint64_t)(mask >> (16 - (cols - j))) << (j & 63);
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+column_sum_avx2(const type *up, const type *row, const type *down, int j) {
+  return _mm256_add_epi8(
+      _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(up + j)),
+                      _mm256_loadu_si256((const __m256i *)(row + j))),
+      _mm256_loadu_si256((const __m256i *)(down + j)));
 }
 
-void updateGrid(type **grid, int rows, int cols, type **out) {
-  for (int i = 0; i < rows; i++)
-    for (int j = 0; j < cols; j++) {
-      int neighbors = count_neighbors(grid, rows, cols, i, j);
-      neighbors -= grid[i][j];
-      if (grid[i][j] && (neighbors < 2 || neighbors > 3))
-        out[i][j] = false;
-      else if (!grid[i][j] && neighbors == 3)
-        out[i][j] = true;
-      else
-        out[i][j] = grid[i][j];
+// returns the new cells as a bit mask: their 1s shifted up to each sign bit
+__attribute__((target("avx2"))) static inline unsigned
+cells_avx2(const type *up, const type *row, const type *down, type *dst, int j,
+           __m256i born, __m256i kept) {
+  __m256i sum = _mm256_add_epi8(
+      _mm256_add_epi8(column_sum_avx2(up, row, down, j - 1),
+                      column_sum_avx2(up, row, down, j)),
+      column_sum_avx2(up, row, down, j + 1));
+  __m256i alive = _mm256_cmpeq_epi8(
+      _mm256_loadu_si256((const __m256i *)(row + j)), _mm256_set1_epi8(1));
+  __m256i next = _mm256_blendv_epi8(_mm256_shuffle_epi8(born, sum),
+                                    _mm256_shuffle_epi8(kept, sum), alive);
+  _mm256_storeu_si256((__m256i *)(dst + j), next);
+  return (unsigned)_mm256_movemask_epi8(_mm256_slli_epi16(next, 7));
+}
+
+__attribute__((target("avx2"))) static void
+update_row_avx2(const type *up, const type *row, const type *down, type *dst,
+                int cols, uint64_t *packed) {
+  const __m256i born = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)rule.born));
+  const __m256i kept = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)rule.kept));
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 32 <= cols; j += 32) {
+    const unsigned mask = cells_avx2(up, row, down, dst, j, born, kept);
+    word |= (uint64_t)mask << (j & 63);
+    if (packed && (j & 63) == 32) {
+      packed[j >> 6] = word;
+      word = 0;
     }
+  }
+  if (j < cols && cols >= 32) {
+    const unsigned mask = cells_avx2(up, row, down, dst, cols - 32, born, kept);
+    word |= (uint64_t)(mask >> (32 - (cols - j))) << (j & 63);
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i
+column_sum_avx512(const type *up, const type *row, const type *down, int j) {
+  return _mm512_add_epi8(
+      _mm512_add_epi8(_mm512_loadu_si512(up + j), _mm512_loadu_si512(row + j)),
+      _mm512_loadu_si512(down + j));
+}
+
+// returns the new cells as a bit mask
+__attribute__((target("avx512f,avx512bw"))) static inline uint64_t
+cells_avx512(const type *up, const type *row, const type *down, type *dst,
+             int j, __m512i born, __m512i kept) {
+  __m512i sum = _mm512_add_epi8(
+      _mm512_add_epi8(column_sum_avx512(up, row, down, j - 1),
+                      column_sum_avx512(up, row, down, j)),
+      column_sum_avx512(up, row, down, j + 1));
+  __mmask64 alive = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row + j),
+                                           _mm512_set1_epi8(1));
+  __m512i next = _mm512_mask_blend_epi8(alive, _mm512_shuffle_epi8(born, sum),
+                                        _mm512_shuffle_epi8(kept, sum));
+  _mm512_storeu_si512(dst + j, next);
+  return _mm512_test_epi8_mask(next, next);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void
+update_row_avx512(const type *up, const type *row, const type *down,
+                  type *dst, int cols, uint64_t *packed) {
+  const __m512i born = _mm512_broadcast_i32x4(
+      _mm_loadu_si128((const __m128i *)rule.born));
+  const __m512i kept = _mm512_broadcast_i32x4(
+      _mm_loadu_si128((const __m128i *)rule.kept));
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 64 <= cols; j += 64) {
+    const uint64_t mask = cells_avx512(up, row, down, dst, j, born, kept);
+    if (packed)
+      packed[j >> 6] = mask;
+  }
+  if (j < cols && cols >= 64) {
+    word = cells_avx512(up, row, down, dst, cols - 64, born, kept) >>
+           (64 - (cols - j));
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+#endif
+
+RowKernel update_row = update_row_scalar;
+
+// picks the widest kernel this CPU supports, via CPUID
+const char *selectRowKernel() {
+#ifdef X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    update_row = update_row_avx512;
+    return "avx512";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    update_row = update_row_avx2;
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    update_row = update_row_sse2;
+    return "sse2";
+  }
+#endif
+  update_row = update_row_scalar;
+  return "scalar";
+}
+
+// Per-generation statistics, gathered while each row is still in cache right
+// after it is written. The bounding box is inclusive; top > bottom when
+// nothing is alive.
+typedef struct {
+  uint64_t population;
+  uint64_t births;
+  uint64_t deaths;
+  int top, left, bottom, right;
+} Stats;
+
+Stats emptyStats() {
+  Stats stats = {0, 0, 0, INT_MAX, INT_MAX, -1, -1};
+  return stats;
 }
 
-type **createGrid(int rows, int cols, bool random) {
-  type **grid = (type **)malloc(rows * sizeof(type *));
-  srand(time(NULL));
-  for (int i = 0; i < rows; i++) {
-    grid[i] = (type *)malloc(cols * sizeof(type));
+// adds row i, which went from prev to next, to stats
+static inline void row_stats(const type *prev, const type *next, int cols,
+                             int i, Stats *stats) {
+  const unsigned char *restrict a = (const unsigned char *)prev;
+  const unsigned char *restrict b = (const unsigned char *)next;
+  unsigned population = 0, births = 0, deaths = 0;
+  for (int j = 0; j < cols; j++) {
+    population += b[j];
+    births += b[j] & (a[j] ^ 1);
+    deaths += a[j] & (b[j] ^ 1);
+  }
+  stats->population += population;
+  stats->births += births;
+  stats->deaths += deaths;
+  if (population) {
+    int left = 0, right = cols - 1;
+    while (!b[left])
+      left++;
+    while (!b[right])
+      right--;
+    stats->top = i < stats->top ? i : stats->top;
+    stats->bottom = i;
+    stats->left = left < stats->left ? left : stats->left;
+    stats->right = right > stats->right ? right : stats->right;
+  }
+}
+
+// combines the partial stats of two disjoint parts of a generation
+void mergeStats(Stats *into, const Stats *part) {
+  into->population += part->population;
+  into->births += part->births;
+  into->deaths += part->deaths;
+  into->top = part->top < into->top ? part->top : into->top;
+  into->left = part->left < into->left ? part->left : into->left;
+  into->bottom = part->bottom > into->bottom ? part->bottom : into->bottom;
+  into->right = part->right > into->right ? part->right : into->right;
+}
+
+// Early stop: every generation is hashed while it is written, and one whose
+// hash matches the generation p steps back repeats with period p. Periods up
+// to CYCLE_PERIOD are found. The row kernels hand over the cells they store
+// already packed, so the byte engines hash without reading a row again; the
+// others pack a row while it is still in cache. -DCYCLE_PERIOD=0 turns it off.
+#ifndef CYCLE_PERIOD
+#define CYCLE_PERIOD 8
+#endif
+
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t h) {
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+// Hash of row i as n words. A generation hashes to the sum over its rows, so
+// threads and ranks add up their own rows in any order. Tiles hash their part
+// of each row under an index of its own instead (see tile_hash).
+static inline uint64_t hash_words(const uint64_t *words, int n, int64_t i) {
+  uint64_t h = mix64(i + 1);
+  for (int w = 0; w < n; w++)
+    h = (h ^ words[w]) * 0x9e3779b97f4a7c15ULL;
+  return mix64(h);
+}
+
+// the same for a row of 0 or 1 byte cells, packed 64 to a word first as the
+// row kernels pack them: one multiply gathers 8 cells into a byte
+static inline uint64_t hash_row(const type *row, int cols, int64_t i) {
+  uint64_t h = mix64(i + 1);
+  for (int j = 0; j < cols; j += 64) {
+    uint64_t word = 0;
+    int k = 0;
+    for (; k < 64 && j + k + 8 <= cols; k += 8) {
+      uint64_t bytes;
+      memcpy(&bytes, row + j + k, sizeof(bytes));
+      word |= (bytes * 0x0102040810204080ULL >> 56) << k;
+    }
+    for (; k < 64 && j + k < cols; k++)
+      word |= (uint64_t)row[j + k] << k;
+    h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+  }
+  return mix64(h);
+}
+
+// a ring of the last generation hashes
+typedef struct {
+  uint64_t hashes[CYCLE_PERIOD + 1];
+  long count;
+} History;
+
+// records a generation's hash and returns its period, or 0 if it is new
+int checkCycle(History *history, uint64_t hash) {
+  int period = 0;
+  for (int p = 1; p <= CYCLE_PERIOD && p <= history->count && !period; p++)
+    if (history->hashes[(history->count - p) % (CYCLE_PERIOD + 1)] == hash)
+      period = p;
+  history->hashes[history->count++ % (CYCLE_PERIOD + 1)] = hash;
+  return period;
+}
+
+// returns the hash of the rows written, and adds them to stats unless NULL
+uint64_t updateRows(Grid *grid, Grid *out, int start_row, int end_row,
+                    Stats *stats) {
+  uint64_t hash = 0;
+#if CYCLE_PERIOD
+  const int words = (grid->cols + 63) / 64;
+  uint64_t *packed = (uint64_t *)malloc(words * sizeof(uint64_t));
+#else
+  uint64_t *packed = NULL;
+#endif
+  for (int i = start_row; i < end_row; i++) {
+    update_row(&CELL(grid, i - 1, 0), &CELL(grid, i, 0), &CELL(grid, i + 1, 0),
+               &CELL(out, i, 0), grid->cols, packed);
+#if CYCLE_PERIOD
+    hash += hash_words(packed, words, i);
+#endif
+    if (stats)
+      row_stats(&CELL(grid, i, 0), &CELL(out, i, 0), grid->cols, i, stats);
+  }
+  free(packed);
+  return hash;
+}
+
+uint64_t updateGrid(Grid *grid, Grid *out, Stats *stats) {
+  return updateRows(grid, out, 0, grid->rows, stats);
+}
+
+// In place: rows [start, end) advance one generation without a second grid.
+// Each row is saved with its border before it is overwritten, so the row
+// below still reads the old one; two saved rows are all the memory used.
+// above and below are rows start - 1 and end as they were, and must be
+// copies when another band overwrites them.
+uint64_t updateRowsInPlace(Grid *grid, int start, int end, const type *above,
+                           const type *below, Stats *stats) {
+  const int cols = grid->cols;
+  const size_t width = (cols + 2) * sizeof(type);
+  uint64_t hash = 0;
+#if CYCLE_PERIOD
+  const int words = (cols + 63) / 64;
+  uint64_t *packed = (uint64_t *)malloc(words * sizeof(uint64_t));
+#else
+  uint64_t *packed = NULL;
+#endif
+  type *ring = (type *)malloc(2 * width);
+  type *up = ring + 1;
+  type *row = ring + cols + 3;
+
+  memcpy(up - 1, above - 1, width);
+  for (int i = start; i < end; i++) {
+    type *cells = &CELL(grid, i, 0);
+    memcpy(row - 1, cells - 1, width);
+    update_row(up, row, i + 1 < end ? &CELL(grid, i + 1, 0) : below, cells,
+               cols, packed);
+#if CYCLE_PERIOD
+    hash += hash_words(packed, words, i);
+#endif
+    if (stats)
+      row_stats(row, cells, cols, i, stats);
+
+    type *tmp = up;
+    up = row;
+    row = tmp;
+  }
+
+  free(ring);
+  free(packed);
+  return hash;
+}
+
+// the border rows are never written, so they need no copies
+uint64_t updateGridInPlace(Grid *grid, Stats *stats) {
+  return updateRowsInPlace(grid, 0, grid->rows, &CELL(grid, -1, 0),
+                           &CELL(grid, grid->rows, 0), stats);
+}
+
+// Separable neighbor count: the horizontal 3-cell sums of each input row are
+// computed once and kept in a ring of three rows, so every output cell adds
+// three partial sums instead of loading its 9 cells again. Cells are read as
+// bytes, which keeps GCC's vectorizer away from bool conversions.
+static void row_sums(const unsigned char *restrict row,
+                     unsigned char *restrict sums, int cols) {
+  for (int j = 0; j < cols; j++)
+    sums[j] = row[j - 1] + row[j] + row[j + 1];
+}
+
+static void add_row_sums(const unsigned char *restrict up,
+                         const unsigned char *restrict mid,
+                         const unsigned char *restrict down,
+                         const unsigned char *restrict row,
+                         unsigned char *restrict sum,
+                         unsigned char *restrict dst, int cols) {
+  for (int j = 0; j < cols; j++) {
+    sum[j] = up[j] + mid[j] + down[j];
+    dst[j] = 0;
+  }
+  // one pass per sum the rule uses, so that every loop vectorizes
+  for (int k = 0; k < rule.born_count; k++) {
+    const unsigned char born = rule.born_sums[k];
+    for (int j = 0; j < cols; j++)
+      dst[j] |= (sum[j] == born) & (row[j] ^ 1);
+  }
+  for (int k = 0; k < rule.kept_count; k++) {
+    const unsigned char kept = rule.kept_sums[k];
     for (int j = 0; j < cols; j++)
-      grid[i][j] = random ? rand() % 2 : false;
+      dst[j] |= (sum[j] == kept) & row[j];
   }
+}
+
+uint64_t updateRowsRowSum(Grid *grid, Grid *out, int start_row, int end_row,
+                          Stats *stats) {
+  const int cols = grid->cols;
+  uint64_t hash = 0;
+  unsigned char *ring = (unsigned char *)malloc(4 * (size_t)cols);
+  unsigned char *up = ring;
+  unsigned char *mid = ring + cols;
+  unsigned char *down = ring + 2 * cols;
+  unsigned char *sum = ring + 3 * cols;
+
+  row_sums((unsigned char *)&CELL(grid, start_row - 1, 0), up, cols);
+  row_sums((unsigned char *)&CELL(grid, start_row, 0), mid, cols);
+  for (int i = start_row; i < end_row; i++) {
+    row_sums((unsigned char *)&CELL(grid, i + 1, 0), down, cols);
+    add_row_sums(up, mid, down, (unsigned char *)&CELL(grid, i, 0), sum,
+                 (unsigned char *)&CELL(out, i, 0), cols);
+#if CYCLE_PERIOD
+    hash += hash_row(&CELL(out, i, 0), cols, i);
+#endif
+    if (stats)
+      row_stats(&CELL(grid, i, 0), &CELL(out, i, 0), cols, i, stats);
+
+    unsigned char *tmp = up;
+    up = mid;
+    mid = down;
+    down = tmp;
+  }
+
+  free(ring);
+  return hash;
+}
+
+uint64_t updateGridRowSum(Grid *grid, Grid *out, Stats *stats) {
+  return updateRowsRowSum(grid, out, 0, grid->rows, stats);
+}
+
+// Active tiles: the grid is cut into TILE x TILE tiles with one flag per tile
+// for "changed last generation". A tile whose 3x3 tile neighborhood did not
+// change computes to what it already is, and since out holds the previous
+// generation it also holds that tile already, so it is skipped.
+#ifndef TILE
+#define TILE 64
+#endif
+
+typedef struct {
+  int rows; // tiles per column
+  int cols; // tiles per row
+  bool *changed;
+  bool *next;
+  uint64_t *hashes; // per tile, of its cells in the newest generation
+  Stats *records;   // with STATS, per tile: its population and bounding box
+} Tiles;
+
+// adds cells [j0, j0 + width) of row i, which went from grid to out, to stats
+static void segment_stats(Grid *grid, Grid *out, int i, int j0, int width,
+                          Stats *stats) {
+  Stats part = emptyStats();
+  row_stats(&CELL(grid, i, j0), &CELL(out, i, j0), width, i, &part);
+  if (part.population) {
+    part.left += j0;
+    part.right += j0;
+  }
+  mergeStats(stats, &part);
+}
+
+#if CYCLE_PERIOD
+// Tile (ti, tj) of grid, its part of row i hashed as row
+// i * tiles->cols + tj
+static uint64_t tile_hash(Grid *grid, Tiles *tiles, int ti, int tj) {
+  const int i0 = ti * TILE, j0 = tj * TILE;
+  const int i1 = i0 + TILE < grid->rows ? i0 + TILE : grid->rows;
+  const int width = (j0 + TILE < grid->cols ? j0 + TILE : grid->cols) - j0;
+  uint64_t hash = 0;
+  for (int i = i0; i < i1; i++)
+    hash += hash_row(&CELL(grid, i, j0), width, (int64_t)i * tiles->cols + tj);
+  return hash;
+}
+#endif
+
+// flags every tile as changed, and hashes and counts the tiles of grid
+Tiles createTiles(Grid *grid) {
+  Tiles tiles;
+  tiles.rows = (grid->rows + TILE - 1) / TILE;
+  tiles.cols = (grid->cols + TILE - 1) / TILE;
+  tiles.changed = (bool *)malloc((size_t)tiles.rows * tiles.cols);
+  tiles.next = (bool *)malloc((size_t)tiles.rows * tiles.cols);
+  tiles.hashes = NULL;
+  tiles.records = NULL;
+  for (size_t t = 0; t < (size_t)tiles.rows * tiles.cols; t++)
+    tiles.changed[t] = true;
+#if CYCLE_PERIOD
+  tiles.hashes =
+      (uint64_t *)malloc((size_t)tiles.rows * tiles.cols * sizeof(uint64_t));
+  for (int ti = 0; ti < tiles.rows; ti++)
+    for (int tj = 0; tj < tiles.cols; tj++)
+      tiles.hashes[(size_t)ti * tiles.cols + tj] =
+          tile_hash(grid, &tiles, ti, tj);
+#endif
+#ifdef STATS
+  tiles.records =
+      (Stats *)malloc((size_t)tiles.rows * tiles.cols * sizeof(Stats));
+  for (int ti = 0; ti < tiles.rows; ti++)
+    for (int tj = 0; tj < tiles.cols; tj++) {
+      Stats *record = &tiles.records[(size_t)ti * tiles.cols + tj];
+      const int i0 = ti * TILE, j0 = tj * TILE;
+      const int i1 = i0 + TILE < grid->rows ? i0 + TILE : grid->rows;
+      const int width = (j0 + TILE < grid->cols ? j0 + TILE : grid->cols) - j0;
+      *record = emptyStats();
+      for (int i = i0; i < i1; i++)
+        segment_stats(grid, grid, i, j0, width, record);
+    }
+#endif
+  return tiles;
+}
+
+void freeTiles(Tiles *tiles) {
+  free(tiles->changed);
+  free(tiles->next);
+  free(tiles->hashes);
+  free(tiles->records);
+}
+
+static bool tile_active(Tiles *tiles, int ti, int tj) {
+  for (int i = ti - 1; i <= ti + 1; i++)
+    for (int j = tj - 1; j <= tj + 1; j++) {
+#ifdef TORUS
+      const int wi = (i + tiles->rows) % tiles->rows;
+      const int wj = (j + tiles->cols) % tiles->cols;
+      if (tiles->changed[(size_t)wi * tiles->cols + wj])
+        return true;
+#else
+      if (i >= 0 && i < tiles->rows && j >= 0 && j < tiles->cols &&
+          tiles->changed[(size_t)i * tiles->cols + j])
+        return true;
+#endif
+    }
+  return false;
+}
+
+// The tile rows [start, end), writing their flags to tiles->next. Each cell
+// row is updated in one call per run of active tiles, and a tile stops
+// comparing old and new cells once it is known to have changed. Only the
+// tiles that changed are hashed again, and only the cells written are
+// counted; the other tiles hold what they did, and add their records.
+uint64_t updateTileRows(Grid *grid, Grid *out, Tiles *tiles, int start,
+                        int end, Stats *stats) {
+  bool *active = (bool *)malloc(tiles->cols);
+  Stats *parts = stats ? (Stats *)malloc(tiles->cols * sizeof(Stats)) : NULL;
+  uint64_t hash = 0;
+  for (int ti = start; ti < end; ti++) {
+    bool *next = &tiles->next[(size_t)ti * tiles->cols];
+    for (int tj = 0; tj < tiles->cols; tj++) {
+      active[tj] = tile_active(tiles, ti, tj);
+      next[tj] = false;
+      if (parts)
+        parts[tj] = emptyStats();
+    }
+
+    const int i1 = (ti + 1) * TILE < grid->rows ? (ti + 1) * TILE : grid->rows;
+    for (int i = ti * TILE; i < i1; i++) {
+      for (int tj = 0; tj < tiles->cols;) {
+        if (!active[tj]) {
+          tj++;
+          continue;
+        }
+        int run = tj;
+        while (tj < tiles->cols && active[tj])
+          tj++;
+
+        const int j0 = run * TILE;
+        const int j1 = tj * TILE < grid->cols ? tj * TILE : grid->cols;
+        update_row(&CELL(grid, i - 1, j0), &CELL(grid, i, j0),
+                   &CELL(grid, i + 1, j0), &CELL(out, i, j0), j1 - j0,
+                   NULL);
+        for (int t = run; t < tj; t++) {
+          const int width = t + 1 < tj ? TILE : j1 - t * TILE;
+          next[t] = next[t] || memcmp(&CELL(grid, i, t * TILE),
+                                      &CELL(out, i, t * TILE),
+                                      width * sizeof(type)) != 0;
+          if (parts)
+            segment_stats(grid, out, i, t * TILE, width, &parts[t]);
+        }
+      }
+    }
+    if (stats) {
+      Stats *records = &tiles->records[(size_t)ti * tiles->cols];
+      for (int tj = 0; tj < tiles->cols; tj++) {
+        if (active[tj]) {
+          records[tj] = parts[tj];
+          records[tj].births = records[tj].deaths = 0;
+        }
+        mergeStats(stats, active[tj] ? &parts[tj] : &records[tj]);
+      }
+    }
+#if CYCLE_PERIOD
+    uint64_t *hashes = &tiles->hashes[(size_t)ti * tiles->cols];
+    for (int tj = 0; tj < tiles->cols; tj++) {
+      if (next[tj])
+        hashes[tj] = tile_hash(out, tiles, ti, tj);
+      hash += hashes[tj];
+    }
+#endif
+  }
+  free(active);
+  free(parts);
+  return hash;
+}
+
+// makes the flags just written the "changed last generation" ones
+void swapTiles(Tiles *tiles) {
+  bool *tmp = tiles->changed;
+  tiles->changed = tiles->next;
+  tiles->next = tmp;
+}
+
+uint64_t updateGridTiles(Grid *grid, Grid *out, Tiles *tiles, Stats *stats) {
+  uint64_t hash = updateTileRows(grid, out, tiles, 0, tiles->rows, stats);
+  swapTiles(tiles);
+  return hash;
+}
+
+// Bit-packed grid: column j of row i is bit (j % 64) of
+// words[i * words_per_row + j / 64]. Bits past cols are always 0.
+typedef struct {
+  uint64_t *words;
+  int rows;
+  int cols;
+  int words_per_row;
+} BitGrid;
+
+BitGrid createBitGrid(int rows, int cols) {
+  BitGrid grid;
+  grid.rows = rows;
+  grid.cols = cols;
+  grid.words_per_row = (cols + 63) / 64;
+  grid.words = (uint64_t *)calloc((size_t)rows * grid.words_per_row,
+                                  sizeof(uint64_t));
+  return grid;
+}
+
+void freeBitGrid(BitGrid *grid) { free(grid->words); }
+
+void swapBitGrid(BitGrid *a, BitGrid *b) {
+  BitGrid tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+void packGrid(Grid *grid, BitGrid *bits) {
+  for (int i = 0; i < bits->rows; i++) {
+    uint64_t *row = bits->words + (size_t)i * bits->words_per_row;
+    for (int w = 0; w < bits->words_per_row; w++)
+      row[w] = 0;
+    for (int j = 0; j < bits->cols; j++)
+      row[j / 64] |= (uint64_t)(CELL(grid, i, j) != 0) << (j % 64);
+  }
+}
+
+void unpackGrid(BitGrid *bits, Grid *grid) {
+  for (int i = 0; i < bits->rows; i++) {
+    uint64_t *row = bits->words + (size_t)i * bits->words_per_row;
+    for (int j = 0; j < bits->cols; j++)
+      CELL(grid, i, j) = (row[j / 64] >> (j % 64)) & 1;
+  }
+}
+
+// one bit-slice full adder: a + b + c = sum + 2 * carry, 64 lanes at once
+static inline void full_add(uint64_t a, uint64_t b, uint64_t c, uint64_t *sum,
+                            uint64_t *carry) {
+  uint64_t t = a ^ b;
+  *sum = t ^ c;
+  *carry = (a & b) | (t & c);
+}
+
+// The 8 neighbors of every bit summed with an adder tree into the binary
+// count (s1, s2, s4, s8).
+static inline void count64(uint64_t nw, uint64_t n, uint64_t ne, uint64_t w,
+                           uint64_t e, uint64_t sw, uint64_t s, uint64_t se,
+                           uint64_t *s1, uint64_t *s2, uint64_t *s4,
+                           uint64_t *s8) {
+  uint64_t top1, top2, bot1, bot2, mid1, mid2;
+  full_add(nw, n, ne, &top1, &top2);
+  full_add(sw, s, se, &bot1, &bot2);
+  mid1 = w ^ e;
+  mid2 = w & e;
+
+  uint64_t ones_carry, twos, fours;
+  full_add(top1, bot1, mid1, s1, &ones_carry);
+  full_add(top2, bot2, mid2, &twos, &fours);
+
+  *s2 = twos ^ ones_carry;
+  *s4 = fours ^ (twos & ones_carry);
+  *s8 = fours & twos & ones_carry;
+}
+
+// B3/S23 on 64 cells: a cell lives if the count is 3, or 2 and it was alive.
+// Only a count of 8 has s8 set, and it has s2 clear, so s8 is not needed.
+static inline uint64_t life64(uint64_t nw, uint64_t n, uint64_t ne,
+                              uint64_t w, uint64_t c, uint64_t e, uint64_t sw,
+                              uint64_t s, uint64_t se) {
+  uint64_t s1, s2, s4, s8;
+  count64(nw, n, ne, w, e, sw, s, se, &s1, &s2, &s4, &s8);
+  return s2 & ~s4 & (s1 | c);
+}
+
+// Any other rule on 64 cells: each count the rule uses is matched as a whole
+// word and gated by the birth or survival side it applies to.
+static inline uint64_t rule_next64(uint64_t s1, uint64_t s2, uint64_t s4,
+                                   uint64_t s8, uint64_t c) {
+  uint64_t next = 0;
+  for (int k = 0; k <= 8; k++) {
+    uint64_t born = rule.table[k] ? ~0ULL : 0;
+    uint64_t kept = rule.table[9 + k] ? ~0ULL : 0;
+    if (!(born | kept))
+      continue;
+    uint64_t match = (k & 1 ? s1 : ~s1) & (k & 2 ? s2 : ~s2) &
+                     (k & 4 ? s4 : ~s4) & (k & 8 ? s8 : ~s8);
+    next |= match & ((born & ~c) | (kept & c));
+  }
+  return next;
+}
+
+static inline uint64_t rule64(uint64_t nw, uint64_t n, uint64_t ne,
+                              uint64_t w, uint64_t c, uint64_t e, uint64_t sw,
+                              uint64_t s, uint64_t se) {
+  uint64_t s1, s2, s4, s8;
+  count64(nw, n, ne, w, e, sw, s, se, &s1, &s2, &s4, &s8);
+  return rule_next64(s1, s2, s4, s8, c);
+}
+
+// neighbors of row[w] shifted in from the west (column j - 1) and east (j + 1)
+static inline uint64_t west_of(const uint64_t *row, int w) {
+  return (row[w] << 1) | (w > 0 ? row[w - 1] >> 63 : 0);
+}
+
+static inline uint64_t east_of(const uint64_t *row, int w, int words) {
+  return (row[w] >> 1) | (w + 1 < words ? row[w + 1] << 63 : 0);
+}
+
+// row_stats on bit-packed rows: popcounts, and the first and last set bits
+static inline void word_row_stats(const uint64_t *prev, const uint64_t *next,
+                                  int words, int i, Stats *stats) {
+  uint64_t population = 0, births = 0, deaths = 0;
+  for (int w = 0; w < words; w++) {
+    population += __builtin_popcountll(next[w]);
+    births += __builtin_popcountll(next[w] & ~prev[w]);
+    deaths += __builtin_popcountll(prev[w] & ~next[w]);
+  }
+  stats->population += population;
+  stats->births += births;
+  stats->deaths += deaths;
+  if (population) {
+    int first = 0, last = words - 1;
+    while (!next[first])
+      first++;
+    while (!next[last])
+      last--;
+    const int left = first * 64 + __builtin_ctzll(next[first]);
+    const int right = last * 64 + 63 - __builtin_clzll(next[last]);
+    stats->top = i < stats->top ? i : stats->top;
+    stats->bottom = i;
+    stats->left = left < stats->left ? left : stats->left;
+    stats->right = right > stats->right ? right : stats->right;
+  }
+}
+
+uint64_t updateBitGrid(BitGrid *grid, BitGrid *out, Stats *stats) {
+  const int words = grid->words_per_row;
+  uint64_t hash = 0;
+  const uint64_t tail = grid->cols % 64 ? (1ULL << (grid->cols % 64)) - 1 : ~0ULL;
+  uint64_t *zero = (uint64_t *)calloc(words, sizeof(uint64_t));
+
+  for (int i = 0; i < grid->rows; i++) {
+    const uint64_t *up = i > 0 ? grid->words + (size_t)(i - 1) * words : zero;
+    const uint64_t *row = grid->words + (size_t)i * words;
+    const uint64_t *down =
+        i + 1 < grid->rows ? grid->words + (size_t)(i + 1) * words : zero;
+    uint64_t *dst = out->words + (size_t)i * words;
+
+    for (int w = 0; w < words; w++) {
+      uint64_t nw = west_of(up, w), ne = east_of(up, w, words);
+      uint64_t west = west_of(row, w), east = east_of(row, w, words);
+      uint64_t sw = west_of(down, w), se = east_of(down, w, words);
+      dst[w] = rule.conway
+                   ? life64(nw, up[w], ne, west, row[w], east, sw, down[w], se)
+                   : rule64(nw, up[w], ne, west, row[w], east, sw, down[w], se);
+    }
+    dst[words - 1] &= tail;
+#if CYCLE_PERIOD
+    hash += hash_words(dst, words, i);
+#endif
+    if (stats)
+      word_row_stats(row, dst, words, i, stats);
+  }
+
+  free(zero);
+  return hash;
+}
+
+// Generations rules: a live cell that is not kept decays through states
+// 2 .. states - 1 before it is dead (0) again. Only state 1 counts as a
+// neighbor and only dead cells can be born. Both "B2/S345/C4" and Golly's
+// "345/2/4" (S/B/C) are accepted.
+#ifndef GEN_RULE
+#define GEN_RULE "B2/S345/C4" // Star Wars
+#endif
+
+#define GEN_PLANES 4 // up to 16 states
+
+bool parseGenerations(const char *rulestring, Rule *out, int *states) {
+  const char *last = strrchr(rulestring, '/');
+  char life[64];
+  if (!last || last - rulestring > (int)sizeof(life) - 4)
+    return false;
+  const char *digits = last + 1;
+  if (*digits && strchr("CcGg", *digits))
+    digits++;
+  int n, used = 0;
+  if (sscanf(digits, "%d%n", &n, &used) != 1 || digits[used] || n < 2 ||
+      n > 1 << GEN_PLANES)
+    return false;
+
+  const int len = last - rulestring;
+  bool letters = false;
+  for (int c = 0; c < len; c++)
+    letters |= strchr("BbSs", rulestring[c]) != NULL;
+  // the first '/', if it is not the one before the state count
+  const char *slash = strchr(rulestring, '/');
+  if (letters)
+    snprintf(life, sizeof(life), "%.*s", len, rulestring);
+  else if (slash != last) // S/B
+    snprintf(life, sizeof(life), "S%.*s/B%.*s", (int)(slash - rulestring),
+             rulestring, (int)(last - slash - 1), slash + 1);
+  else
+    return false;
+  if (!parseRule(life, out))
+    return false;
+  *states = n;
+  return true;
+}
+
+// A Generations grid as bit planes: bit k of a cell's state is its bit in
+// planes[k], so a generation moves ceil(log2(states)) bits per cell.
+typedef struct {
+  BitGrid planes[GEN_PLANES];
+  int count; // planes in use
+  int states;
+} GenGrid;
+
+GenGrid createGenGrid(int rows, int cols, int states) {
+  GenGrid grid = {.count = 1, .states = states};
+  while (1 << grid.count < states)
+    grid.count++;
+  for (int k = 0; k < grid.count; k++)
+    grid.planes[k] = createBitGrid(rows, cols);
   return grid;
 }
 
-void freeGrid(type **grid, int rows) {
-  for (int i = 0; i < rows; i++)
-    free(grid[i]);
-  free(grid);
+void freeGenGrid(GenGrid *grid) {
+  for (int k = 0; k < grid->count; k++)
+    freeBitGrid(&grid->planes[k]);
 }
 
-void swap(type ***a, type ***b) {
-  type **tmp = *a;
+void swapGenGrid(GenGrid *a, GenGrid *b) {
+  GenGrid tmp = *a;
   *a = *b;
   *b = tmp;
 }
 
-void draw2file(type **grid, int step, unsigned char *data) {
-  for (int i = 0; i < ROWS * SCALE; i++)
-    for (int j = 0; j < COLS * SCALE; j++) {
-      unsigned char color = grid[i / SCALE][j / SCALE] * 255;
-      int index = (i * COLS * SCALE + j) * 3;
+// word w of the cells in state 1
+static inline uint64_t gen_live(GenGrid *grid, size_t w) {
+  uint64_t dying = 0;
+  for (int k = 1; k < grid->count; k++)
+    dying |= grid->planes[k].words[w];
+  return grid->planes[0].words[w] & ~dying;
+}
+
+// live cells start in state 1
+void packGenGrid(Grid *grid, GenGrid *gen) {
+  packGrid(grid, &gen->planes[0]);
+  for (int k = 1; k < gen->count; k++)
+    memset(gen->planes[k].words, 0,
+           (size_t)grid->rows * gen->planes[k].words_per_row * sizeof(uint64_t));
+}
+
+// only state 1 is drawn, decaying cells show as dead
+void unpackGenGrid(GenGrid *gen, Grid *grid) {
+  const int words = gen->planes[0].words_per_row;
+  for (int i = 0; i < grid->rows; i++)
+    for (int j = 0; j < grid->cols; j++)
+      CELL(grid, i, j) = gen_live(gen, (size_t)i * words + j / 64) >> (j % 64) & 1;
+}
+
+static void gen_live_row(GenGrid *grid, int i, uint64_t *live) {
+  const int words = grid->planes[0].words_per_row;
+  for (int w = 0; w < words; w++)
+    live[w] = i >= 0 && i < grid->planes[0].rows
+                  ? gen_live(grid, (size_t)i * words + w)
+                  : 0;
+}
+
+// Counts come from the live plane as in updateBitGrid. Kept and born cells
+// go to state 1; every other non-dead cell is incremented bit-sliced across
+// the planes, and the ones that reach `states` wrap to dead.
+uint64_t updateGenGrid(GenGrid *grid, GenGrid *out) {
+  uint64_t hash = 0;
+  const int words = grid->planes[0].words_per_row;
+  const int cols = grid->planes[0].cols;
+  const uint64_t tail = cols % 64 ? (1ULL << (cols % 64)) - 1 : ~0ULL;
+  uint64_t *lines = (uint64_t *)calloc(3 * (size_t)words, sizeof(uint64_t));
+  uint64_t *up = lines, *row = up + words, *down = row + words;
+  gen_live_row(grid, 0, row);
+
+  for (int i = 0; i < grid->planes[0].rows; i++) {
+    gen_live_row(grid, i + 1, down);
+    for (int w = 0; w < words; w++) {
+      uint64_t s1, s2, s4, s8;
+      count64(west_of(up, w), up[w], east_of(up, w, words), west_of(row, w),
+              east_of(row, w, words), west_of(down, w), down[w],
+              east_of(down, w, words), &s1, &s2, &s4, &s8);
+
+      const size_t at = (size_t)i * words + w;
+      uint64_t state[GEN_PLANES], any = 0;
+      for (int k = 0; k < grid->count; k++)
+        any |= state[k] = grid->planes[k].words[at];
+      // births only land on dead cells, not on decaying ones
+      uint64_t next = rule_next64(s1, s2, s4, s8, row[w]) & (row[w] | ~any);
+
+      uint64_t carry = any & ~next, wrap = ~0ULL;
+      for (int k = 0; k < grid->count; k++) {
+        uint64_t bit = state[k];
+        state[k] ^= carry;
+        carry &= bit;
+        wrap &= grid->states >> k & 1 ? state[k] : ~state[k];
+      }
+      out->planes[0].words[at] = (state[0] & ~wrap) | next;
+      for (int k = 1; k < grid->count; k++)
+        out->planes[k].words[at] = state[k] & ~wrap;
+    }
+    for (int k = 0; k < grid->count; k++) {
+      out->planes[k].words[(size_t)i * words + words - 1] &= tail;
+#if CYCLE_PERIOD
+      hash += hash_words(out->planes[k].words + (size_t)i * words, words,
+                         i * GEN_PLANES + k);
+#endif
+    }
+
+    uint64_t *recycled = up;
+    up = row;
+    row = down;
+    down = recycled;
+  }
+
+  free(lines);
+  return hash;
+}
+
+// 4x4 -> 2x2 lookup table. Bit 4 * r + c of the index is cell (r, c) of a
+// 4x4 block; the entry holds the next state of its inner 2x2 cells, bit
+// 2 * r + c for cell (r + 1, c + 1).
+uint8_t life_table[1 << 16];
+
+void buildLifeTable() {
+  for (int index = 0; index < 1 << 16; index++) {
+    uint8_t next = 0;
+    for (int r = 1; r <= 2; r++)
+      for (int c = 1; c <= 2; c++) {
+        int neighbors = 0;
+        for (int dr = -1; dr <= 1; dr++)
+          for (int dc = -1; dc <= 1; dc++)
+            if (dr || dc)
+              neighbors += (index >> (4 * (r + dr) + c + dc)) & 1;
+        int alive = (index >> (4 * r + c)) & 1;
+        next |= rule.table[9 * alive + neighbors] << (2 * (r - 1) + c - 1);
+      }
+    life_table[index] = next;
+  }
+}
+
+// row[w] with the cell west of it shifted in at bit 0: bits 2k..2k+3 are the
+// 4 cells from column 64 * w + 2 * k - 1 on. The last block (k = 31) also
+// needs the two cells east of the word, returned in *east.
+static inline uint64_t nibble_row(const uint64_t *row, int w, int words,
+                                  uint64_t *east) {
+  *east = (row[w] >> 63) | (w + 1 < words ? (row[w + 1] & 1) << 1 : 0);
+  return (row[w] << 1) | (w > 0 ? row[w - 1] >> 63 : 0);
+}
+
+// Two output rows at a time: each 2x2 output block is one table lookup on the
+// nibbles of the four input rows around it.
+uint64_t updateBitGridLUT(BitGrid *grid, BitGrid *out, Stats *stats) {
+  const int words = grid->words_per_row;
+  uint64_t hash = 0;
+  const uint64_t tail = grid->cols % 64 ? (1ULL << (grid->cols % 64)) - 1 : ~0ULL;
+  uint64_t *zero = (uint64_t *)calloc(words, sizeof(uint64_t));
+  uint64_t *spill = (uint64_t *)calloc(words, sizeof(uint64_t));
+
+  for (int i = 0; i < grid->rows; i += 2) {
+    const uint64_t *in[4];
+    for (int r = 0; r < 4; r++) {
+      int src = i - 1 + r;
+      in[r] = src >= 0 && src < grid->rows
+                  ? grid->words + (size_t)src * words
+                  : zero;
+    }
+    uint64_t *top = out->words + (size_t)i * words;
+    uint64_t *bottom =
+        i + 1 < grid->rows ? out->words + (size_t)(i + 1) * words : spill;
+
+    for (int w = 0; w < words; w++) {
+      uint64_t lo[4], hi[4];
+      for (int r = 0; r < 4; r++)
+        lo[r] = nibble_row(in[r], w, words, &hi[r]);
+
+      uint64_t t = 0, b = 0;
+      for (int k = 0; k < 31; k++) {
+        unsigned index = (lo[0] >> (2 * k) & 0xF) |
+                         (lo[1] >> (2 * k) & 0xF) << 4 |
+                         (lo[2] >> (2 * k) & 0xF) << 8 |
+                         (lo[3] >> (2 * k) & 0xF) << 12;
+        uint64_t next = life_table[index];
+        t |= (next & 3) << (2 * k);
+        b |= (next >> 2) << (2 * k);
+      }
+      unsigned index = (lo[0] >> 62 | hi[0] << 2) |
+                       (lo[1] >> 62 | hi[1] << 2) << 4 |
+                       (lo[2] >> 62 | hi[2] << 2) << 8 |
+                       (lo[3] >> 62 | hi[3] << 2) << 12;
+      uint64_t next = life_table[index];
+      t |= (next & 3) << 62;
+      b |= (next >> 2) << 62;
+      top[w] = t;
+      bottom[w] = b;
+    }
+    top[words - 1] &= tail;
+    bottom[words - 1] &= tail;
+#if CYCLE_PERIOD
+    hash += hash_words(top, words, i);
+    if (i + 1 < grid->rows)
+      hash += hash_words(bottom, words, i + 1);
+#endif
+    if (stats) {
+      word_row_stats(in[1], top, words, i, stats);
+      if (i + 1 < grid->rows)
+        word_row_stats(in[2], bottom, words, i + 1, stats);
+    }
+  }
+
+  free(zero);
+  free(spill);
+  return hash;
+}
+
+// Hashlife: the universe is a quadtree of canonical (hash-consed) nodes, so
+// identical squares are stored once, and the result of advancing a node is
+// memoized on the node itself. A node of level k is a 2^k square; its result
+// is its centered 2^(k-1) square after up to 2^(k-2) generations.
+//
+// Unlike the fixed grid, the Hashlife universe is unbounded: patterns that
+// reach the grid edge keep going instead of being clipped, and only the cells
+// inside the grid are written back.
+#ifndef HL_MAX_NODES
+#define HL_MAX_NODES (1 << 22) // garbage collect past this many nodes
+#endif
+
+#ifndef HL_STEP
+#define HL_STEP 1 // generations per step with ENGINE_HASHLIFE
+#endif
+
+typedef struct Node {
+  struct Node *nw, *ne, *sw, *se;
+  struct Node *result; // memoized 2^result_log generations ahead
+  struct Node *next;   // hash chain
+  uint64_t population;
+  int8_t level;
+  int8_t result_log;
+  bool mark;
+} Node;
+
+typedef struct {
+  Node *root;
+  int64_t top; // world coordinates of the root's top-left cell
+  int64_t left;
+  uint64_t generation;
+} HashLife;
+
+Node hl_leaves[2] = {{.population = 0, .result_log = -1, .mark = true},
+                     {.population = 1, .result_log = -1, .mark = true}};
+Node *hl_empty[64];
+Node **hl_table;
+size_t hl_buckets;
+size_t hl_nodes;
+
+static inline size_t hl_hash(Node *nw, Node *ne, Node *sw, Node *se) {
+  uint64_t h = (uintptr_t)nw;
+  h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t)ne;
+  h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t)sw;
+  h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t)se;
+  return (size_t)(h ^ (h >> 31));
+}
+
+static void hl_rehash(size_t buckets) {
+  Node **table = (Node **)calloc(buckets, sizeof(Node *));
+  for (size_t b = 0; b < hl_buckets; b++)
+    for (Node *n = hl_table[b], *next; n; n = next) {
+      next = n->next;
+      size_t h = hl_hash(n->nw, n->ne, n->sw, n->se) & (buckets - 1);
+      n->next = table[h];
+      table[h] = n;
+    }
+  free(hl_table);
+  hl_table = table;
+  hl_buckets = buckets;
+}
+
+// the canonical node with these four children
+Node *hl_node(Node *nw, Node *ne, Node *sw, Node *se) {
+  size_t h = hl_hash(nw, ne, sw, se) & (hl_buckets - 1);
+  for (Node *n = hl_table[h]; n; n = n->next)
+    if (n->nw == nw && n->ne == ne && n->sw == sw && n->se == se)
+      return n;
+
+  Node *n = (Node *)malloc(sizeof(Node));
+  n->nw = nw;
+  n->ne = ne;
+  n->sw = sw;
+  n->se = se;
+  n->result = NULL;
+  n->result_log = -1;
+  n->mark = false;
+  n->level = nw->level + 1;
+  n->population =
+      nw->population + ne->population + sw->population + se->population;
+  n->next = hl_table[h];
+  hl_table[h] = n;
+  if (++hl_nodes > hl_buckets)
+    hl_rehash(hl_buckets * 2);
+  return n;
+}
+
+Node *hl_empty_node(int level) {
+  if (!hl_empty[level])
+    hl_empty[level] = level == 0 ? &hl_leaves[0]
+                                 : hl_node(hl_empty_node(level - 1),
+                                           hl_empty_node(level - 1),
+                                           hl_empty_node(level - 1),
+                                           hl_empty_node(level - 1));
+  return hl_empty[level];
+}
+
+// the centered square one level down, not advanced
+static Node *hl_center(Node *n) {
+  return hl_node(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+}
+
+// 4x4 base case: one generation through the life_table
+static Node *hl_base(Node *n) {
+  Node *q[4] = {n->nw, n->ne, n->sw, n->se};
+  unsigned index = 0;
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++) {
+      Node *quad = q[(r / 2) * 2 + c / 2];
+      Node *cell = (r % 2 ? (c % 2 ? quad->se : quad->sw)
+                          : (c % 2 ? quad->ne : quad->nw));
+      index |= (unsigned)cell->population << (4 * r + c);
+    }
+  uint8_t next = life_table[index];
+  return hl_node(&hl_leaves[next & 1], &hl_leaves[(next >> 1) & 1],
+                 &hl_leaves[(next >> 2) & 1], &hl_leaves[(next >> 3) & 1]);
+}
+
+// the center of n after 2^step_log generations, step_log <= level - 2
+Node *hl_result(Node *n, int step_log) {
+  if (n->result_log == step_log)
+    return n->result;
+
+  Node *result;
+  if (n->population == 0)
+    result = hl_empty_node(n->level - 1);
+  else if (n->level == 2)
+    result = hl_base(n);
+  else {
+    // the nine overlapping squares one level down
+    Node *sub[9] = {
+        n->nw,
+        hl_node(n->nw->ne, n->ne->nw, n->nw->se, n->ne->sw),
+        n->ne,
+        hl_node(n->nw->sw, n->nw->se, n->sw->nw, n->sw->ne),
+        hl_node(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw),
+        hl_node(n->ne->sw, n->ne->se, n->se->nw, n->se->ne),
+        n->sw,
+        hl_node(n->sw->ne, n->se->nw, n->sw->se, n->se->sw),
+        n->se,
+    };
+    // a full step advances 2^(level-3) twice, a shorter one only the second
+    // time, by the whole 2^step_log
+    bool full = step_log == n->level - 2;
+    int half = full ? step_log - 1 : step_log;
+    for (int s = 0; s < 9; s++)
+      sub[s] = full ? hl_result(sub[s], half) : hl_center(sub[s]);
+
+    result = hl_node(hl_result(hl_node(sub[0], sub[1], sub[3], sub[4]), half),
+                     hl_result(hl_node(sub[1], sub[2], sub[4], sub[5]), half),
+                     hl_result(hl_node(sub[3], sub[4], sub[6], sub[7]), half),
+                     hl_result(hl_node(sub[4], sub[5], sub[7], sub[8]), half));
+  }
+
+  n->result = result;
+  n->result_log = step_log;
+  return result;
+}
+
+// Garbage collection: keep what the root and the empty nodes reach, drop the
+// rest, and forget memoized results whose node was dropped.
+static void hl_mark(Node *n) {
+  if (n->mark)
+    return;
+  n->mark = true;
+  hl_mark(n->nw);
+  hl_mark(n->ne);
+  hl_mark(n->sw);
+  hl_mark(n->se);
+}
+
+void hashlifeCollect(HashLife *hl) {
+  hl_mark(hl->root);
+  for (int level = 1; level < 64; level++)
+    if (hl_empty[level])
+      hl_mark(hl_empty[level]);
+
+  for (size_t b = 0; b < hl_buckets; b++)
+    for (Node *n = hl_table[b]; n; n = n->next)
+      if (n->mark && n->result && !n->result->mark) {
+        n->result = NULL;
+        n->result_log = -1;
+      }
+
+  for (size_t b = 0; b < hl_buckets; b++) {
+    Node **link = &hl_table[b];
+    while (*link) {
+      Node *n = *link;
+      if (n->mark) {
+        n->mark = false;
+        link = &n->next;
+      } else {
+        *link = n->next;
+        free(n);
+        hl_nodes--;
+      }
+    }
+  }
+}
+
+static Node *hl_build(Grid *grid, int level, int64_t top, int64_t left) {
+  if (top >= grid->rows || left >= grid->cols)
+    return hl_empty_node(level);
+  if (level == 0)
+    return &hl_leaves[CELL(grid, top, left) != 0];
+  int64_t half = (int64_t)1 << (level - 1);
+  return hl_node(hl_build(grid, level - 1, top, left),
+                 hl_build(grid, level - 1, top, left + half),
+                 hl_build(grid, level - 1, top + half, left),
+                 hl_build(grid, level - 1, top + half, left + half));
+}
+
+static void hl_paint(Node *n, int64_t top, int64_t left, Grid *grid) {
+  int64_t size = (int64_t)1 << n->level;
+  if (n->population == 0 || top >= grid->rows || left >= grid->cols ||
+      top + size <= 0 || left + size <= 0)
+    return;
+  if (n->level == 0) {
+    CELL(grid, top, left) = true;
+    return;
+  }
+  int64_t half = size / 2;
+  hl_paint(n->nw, top, left, grid);
+  hl_paint(n->ne, top, left + half, grid);
+  hl_paint(n->sw, top + half, left, grid);
+  hl_paint(n->se, top + half, left + half, grid);
+}
+
+// loads the grid as the universe at generation 0, top-left cell at (0, 0)
+HashLife hashlifeFromGrid(Grid *grid) {
+  if (!hl_table) {
+    hl_buckets = 1 << 16;
+    hl_table = (Node **)calloc(hl_buckets, sizeof(Node *));
+    buildLifeTable();
+  }
+
+  int level = 3;
+  while (((int64_t)1 << level) < grid->rows ||
+         ((int64_t)1 << level) < grid->cols)
+    level++;
+
+  HashLife hl = {hl_build(grid, level, 0, 0), 0, 0, 0};
+  return hl;
+}
+
+// writes the part of the universe that falls inside the grid
+void hashlifeToGrid(HashLife *hl, Grid *grid) {
+  for (int i = 0; i < grid->rows; i++)
+    for (int j = 0; j < grid->cols; j++)
+      CELL(grid, i, j) = false;
+  hl_paint(hl->root, hl->top, hl->left, grid);
+}
+
+// doubles the root around its center
+static void hl_expand(HashLife *hl) {
+  Node *r = hl->root;
+  Node *e = hl_empty_node(r->level - 1);
+  int64_t quarter = (int64_t)1 << (r->level - 1);
+  hl->root = hl_node(hl_node(e, e, e, r->nw), hl_node(e, e, r->ne, e),
+                     hl_node(e, r->sw, e, e), hl_node(r->se, e, e, e));
+  hl->top -= quarter;
+  hl->left -= quarter;
+}
+
+// true when every live cell is in the central quarter of the root, so nothing
+// can leave the result square within 2^(level-3) generations
+static bool hl_padded(Node *r) {
+  return r->population == r->nw->se->se->population +
+                              r->ne->sw->sw->population +
+                              r->sw->ne->ne->population +
+                              r->se->nw->nw->population;
+}
+
+// advances any number of generations (below 2^57) as a sum of power-of-two
+// jumps
+void hashlifeAdvance(HashLife *hl, uint64_t generations) {
+  for (int step_log = 56; step_log >= 0; step_log--) {
+    if (!(generations >> step_log & 1))
+      continue;
+    while (hl->root->level < step_log + 3 || !hl_padded(hl->root))
+      hl_expand(hl);
+
+    int64_t quarter = (int64_t)1 << (hl->root->level - 2);
+    hl->root = hl_result(hl->root, step_log);
+    hl->top += quarter;
+    hl->left += quarter;
+    hl->generation += (uint64_t)1 << step_log;
+
+    if (hl_nodes > HL_MAX_NODES)
+      hashlifeCollect(hl);
+  }
+}
+
+// Sparse universe: only the live cells are stored, as packed (row, col) keys.
+// A generation scatters every live cell into an open-addressing table of
+// neighbor counts around the live cells, then keeps the entries that live.
+// Memory follows the population, not the area, and like Hashlife the
+// universe is unbounded (32-bit coordinates), not clipped to the grid.
+typedef struct {
+  uint64_t *cells; // live cells, (uint32_t)row << 32 | (uint32_t)col
+  size_t count;
+  size_t capacity;
+  uint64_t *keys; // counting table, sized from the population every step
+  uint8_t *counts; // neighbors, + SPARSE_ALIVE if the cell is live; 0 = free
+  size_t buckets;
+  uint64_t generation;
+} Sparse;
+
+#define SPARSE_ALIVE 16
+
+static inline uint64_t sparse_key(int32_t row, int32_t col) {
+  return (uint64_t)(uint32_t)row << 32 | (uint32_t)col;
+}
+
+static void sparse_push(Sparse *sparse, uint64_t key) {
+  if (sparse->count == sparse->capacity) {
+    sparse->capacity = sparse->capacity ? sparse->capacity * 2 : 1024;
+    sparse->cells = (uint64_t *)realloc(sparse->cells,
+                                        sparse->capacity * sizeof(uint64_t));
+  }
+  sparse->cells[sparse->count++] = key;
+}
+
+static inline void sparse_add(Sparse *sparse, uint64_t key, uint8_t amount) {
+  size_t mask = sparse->buckets - 1;
+  size_t h = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+  while (sparse->counts[h] && sparse->keys[h] != key)
+    h = (h + 1) & mask;
+  sparse->keys[h] = key;
+  sparse->counts[h] += amount;
+}
+
+Sparse sparseFromGrid(Grid *grid) {
+  Sparse sparse = {0};
+  for (int i = 0; i < grid->rows; i++)
+    for (int j = 0; j < grid->cols; j++)
+      if (CELL(grid, i, j))
+        sparse_push(&sparse, sparse_key(i, j));
+  return sparse;
+}
+
+// writes the live cells that fall inside the grid
+void sparseToGrid(Sparse *sparse, Grid *grid) {
+  for (int i = 0; i < grid->rows; i++)
+    for (int j = 0; j < grid->cols; j++)
+      CELL(grid, i, j) = false;
+  for (size_t c = 0; c < sparse->count; c++) {
+    int32_t row = (int32_t)(sparse->cells[c] >> 32);
+    int32_t col = (int32_t)(uint32_t)sparse->cells[c];
+    if (row >= 0 && row < grid->rows && col >= 0 && col < grid->cols)
+      CELL(grid, row, col) = true;
+  }
+}
+
+void updateSparse(Sparse *sparse) {
+  // at most 9 entries per live cell, kept under half full
+  size_t buckets = 1024;
+  while (buckets < sparse->count * 18)
+    buckets *= 2;
+  if (buckets != sparse->buckets) {
+    free(sparse->keys);
+    free(sparse->counts);
+    sparse->keys = (uint64_t *)malloc(buckets * sizeof(uint64_t));
+    sparse->counts = (uint8_t *)malloc(buckets);
+    sparse->buckets = buckets;
+  }
+  memset(sparse->counts, 0, buckets);
+
+  for (size_t c = 0; c < sparse->count; c++) {
+    int32_t row = (int32_t)(sparse->cells[c] >> 32);
+    int32_t col = (int32_t)(uint32_t)sparse->cells[c];
+    for (int di = -1; di <= 1; di++)
+      for (int dj = -1; dj <= 1; dj++)
+        sparse_add(sparse, sparse_key(row + di, col + dj),
+                   di || dj ? 1 : SPARSE_ALIVE);
+  }
+
+  sparse->count = 0;
+  for (size_t h = 0; h < buckets; h++) {
+    int neighbors = sparse->counts[h] & (SPARSE_ALIVE - 1);
+    bool alive = sparse->counts[h] & SPARSE_ALIVE;
+    if (sparse->counts[h] && rule.table[9 * alive + neighbors])
+      sparse_push(sparse, sparse->keys[h]);
+  }
+  sparse->generation++;
+}
+
+void freeSparse(Sparse *sparse) {
+  free(sparse->cells);
+  free(sparse->keys);
+  free(sparse->counts);
+}
+
+// Seeded, counter-based initial cells: cell n, counting row-major over the
+// whole grid, is alive when byte n % 8 of mix64(key + n / 8) is below
+// density * 256. Any thread or rank can draw any run of cells, and a seed
+// gives the same grid however the work is split.
+#ifndef SEED
+#define SEED 1
+#endif
+
+#ifndef DENSITY
+#define DENSITY 0.5 // of live cells, in steps of 1/256
+#endif
+
+static inline type random_cell(uint64_t key, uint64_t n, unsigned threshold) {
+  return (mix64(key + n / 8) >> n % 8 * 8 & 0xff) < threshold;
+}
+
+// cells [0, count) of dst become cells [n, n + count) of the grid
+void randomCells(type *dst, uint64_t n, size_t count, uint64_t seed,
+                 double density) {
+  const uint64_t key = mix64(seed);
+  const unsigned threshold = (unsigned)(density * 256 + 0.5);
+  size_t k = 0;
+  for (; k < count && (n + k) % 8; k++)
+    dst[k] = random_cell(key, n + k, threshold);
+  // one hash per 8 cells
+  for (; k + 8 <= count; k += 8) {
+    const uint64_t bits = mix64(key + (n + k) / 8);
+    for (int b = 0; b < 8; b++)
+      dst[k + b] = (bits >> 8 * b & 0xff) < threshold;
+  }
+  for (; k < count; k++)
+    dst[k] = random_cell(key, n + k, threshold);
+}
+
+void randomGrid(Grid *grid, uint64_t seed, double density) {
+  for (int i = 0; i < grid->rows; i++)
+    randomCells(&CELL(grid, i, 0), (uint64_t)i * grid->cols, grid->cols, seed,
+                density);
+}
+
+// stride is in cells, 0 picks cols + 2 rounded up to GRID_ALIGN bytes
+Grid createGrid(int rows, int cols, int stride) {
+  const int per_line = GRID_ALIGN / sizeof(type);
+  if (stride < cols + 2)
+    stride = (cols + 2 + per_line - 1) / per_line * per_line;
+
+  Grid grid;
+  grid.rows = rows;
+  grid.cols = cols;
+  grid.stride = stride;
+  grid.block = calloc((size_t)(rows + 2) * stride * sizeof(type) + GRID_ALIGN,
+                      1);
+  // align cell (0, 0) so every row starts on a GRID_ALIGN boundary when the
+  // stride is a multiple of it
+  uintptr_t first = (uintptr_t)grid.block + (stride + 1) * sizeof(type);
+  uintptr_t pad = (GRID_ALIGN - first % GRID_ALIGN) % GRID_ALIGN;
+  grid.cells = (type *)(first + pad);
+
+  return grid;
+}
+
+void freeGrid(Grid *grid) { free(grid->block); }
+
+void swap(Grid *a, Grid *b) {
+  Grid tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Copies the opposite edges into the ghost border, corners included, once
+// per generation, so the kernels wrap around without any index arithmetic.
+void wrapGrid(Grid *grid) {
+  for (int i = 0; i < grid->rows; i++) {
+    CELL(grid, i, -1) = CELL(grid, i, grid->cols - 1);
+    CELL(grid, i, grid->cols) = CELL(grid, i, 0);
+  }
+  memcpy(&CELL(grid, -1, -1), &CELL(grid, grid->rows - 1, -1),
+         (grid->cols + 2) * sizeof(type));
+  memcpy(&CELL(grid, grid->rows, -1), &CELL(grid, 0, -1),
+         (grid->cols + 2) * sizeof(type));
+}
+
+// Temporal blocking: out becomes grid advanced by depth generations, one
+// TB_ROWS x TB_COLS tile at a time. Each tile is copied with a halo of depth
+// cells into two small buffers and advanced depth times there while they
+// stay in cache, the computed area shrinking by one cell a generation until
+// it is the tile itself. Cells outside the grid are never computed, so they
+// stay dead as with the full sweep and the result is bit-identical to it.
+#ifndef TB_ROWS
+#define TB_ROWS 128
+#endif
+
+#ifndef TB_COLS
+#define TB_COLS 512
+#endif
+
+#ifndef TB_DEPTH
+#define TB_DEPTH 8 // generations per block
+#endif
+
+static inline int imin(int a, int b) { return a < b ? a : b; }
+static inline int imax(int a, int b) { return a > b ? a : b; }
+
+void clearGrid(Grid *grid) {
+  for (int i = 0; i < grid->rows; i++)
+    memset(&CELL(grid, i, 0), 0, grid->cols * sizeof(type));
+}
+
+#ifdef TORUS
+// cells [from, to) of a torus row, where from may be negative and to past cols
+static void copy_wrapped(type *dst, const type *row, int from, int to,
+                         int cols) {
+  while (from < to) {
+    const int j = (from % cols + cols) % cols;
+    const int n = imin(to - from, cols - j);
+    memcpy(dst, row + j, n * sizeof(type));
+    dst += n;
+    from += n;
+  }
+}
+#endif
+
+void updateGridBlocked(Grid *grid, Grid *out, int depth) {
+  Grid a = createGrid(TB_ROWS + 2 * depth, TB_COLS + 2 * depth, 0);
+  Grid b = createGrid(TB_ROWS + 2 * depth, TB_COLS + 2 * depth, 0);
+#ifdef TORUS
+  // the halo wraps around, so nothing is clipped to the grid
+  const int rows_lo = INT_MIN / 2, rows_hi = INT_MAX / 2;
+  const int cols_lo = INT_MIN / 2, cols_hi = INT_MAX / 2;
+#else
+  const int rows_lo = 0, rows_hi = grid->rows;
+  const int cols_lo = 0, cols_hi = grid->cols;
+#endif
+
+  for (int r0 = 0; r0 < grid->rows; r0 += TB_ROWS)
+    for (int c0 = 0; c0 < grid->cols; c0 += TB_COLS) {
+      const int r1 = imin(r0 + TB_ROWS, grid->rows);
+      const int c1 = imin(c0 + TB_COLS, grid->cols);
+      // local cell (0, 0) is global cell (top, left)
+      const int top = r0 - depth, left = c0 - depth;
+
+      clearGrid(&a);
+      clearGrid(&b);
+#ifdef TORUS
+      for (int i = top; i < r1 + depth; i++)
+        copy_wrapped(&CELL(&a, i - top, 0),
+                     &CELL(grid, (i % grid->rows + grid->rows) % grid->rows, 0),
+                     left, c1 + depth, grid->cols);
+#else
+      const int j0 = imax(left, 0), j1 = imin(c1 + depth, grid->cols);
+      for (int i = imax(top, 0); i < imin(r1 + depth, grid->rows); i++)
+        memcpy(&CELL(&a, i - top, j0 - left), &CELL(grid, i, j0),
+               (j1 - j0) * sizeof(type));
+#endif
+
+      for (int s = 1; s <= depth; s++) {
+        const int i0 = imax(top + s, rows_lo);
+        const int i1 = imin(r1 + depth - s, rows_hi);
+        const int j0 = imax(left + s, cols_lo);
+        const int j1 = imin(c1 + depth - s, cols_hi);
+        for (int i = i0; i < i1; i++)
+          update_row(&CELL(&a, i - top - 1, j0 - left),
+                     &CELL(&a, i - top, j0 - left),
+                     &CELL(&a, i - top + 1, j0 - left),
+                     &CELL(&b, i - top, j0 - left), j1 - j0, NULL);
+        swap(&a, &b);
+      }
+
+      for (int i = r0; i < r1; i++)
+        memcpy(&CELL(out, i, c0), &CELL(&a, i - top, c0 - left),
+               (c1 - c0) * sizeof(type));
+    }
+
+  freeGrid(&a);
+  freeGrid(&b);
+}
+
+// Larger than Life: radius-R Moore (square) or von Neumann (diamond)
+// neighborhoods, rulestrings in the "R5,C0,M1,S34..58,B34..45,NM" form. A
+// cell is born when dead with a count in [born_min, born_max] and survives
+// when alive with a count in [kept_min, kept_max]; M1 counts the cell itself.
+#ifndef LTL_RULE
+#define LTL_RULE "R5,C0,M1,S34..58,B34..45,NM" // Bosco's rule
+#endif
+
+typedef struct {
+  int radius;
+  bool middle;
+  bool von_neumann;
+  int born_min, born_max;
+  int kept_min, kept_max;
+} LtLRule;
+
+bool parseLtL(const char *rulestring, LtLRule *out) {
+  LtLRule parsed = {1, false, false, 3, 3, 2, 3};
+  const char *c = rulestring;
+  while (*c) {
+    char key = *c++;
+    int low = 0, high = 0, used = 0;
+    if (key == 'N') {
+      if (*c != 'M' && *c != 'N')
+        return false;
+      parsed.von_neumann = *c++ == 'N';
+    } else if (sscanf(c, "%d..%d%n", &low, &high, &used) == 2 ||
+               sscanf(c, "%d%n", &low, &used) == 1) {
+      if (used == 0 || low < 0)
+        return false;
+      if (high < low)
+        high = low;
+      c += used;
+      if (key == 'R' && low >= 1)
+        parsed.radius = low;
+      else if (key == 'C' && low <= 2)
+        ; // two states only
+      else if (key == 'M' && low <= 1)
+        parsed.middle = low;
+      else if (key == 'B') {
+        parsed.born_min = low;
+        parsed.born_max = high;
+      } else if (key == 'S') {
+        parsed.kept_min = low;
+        parsed.kept_max = high;
+      } else
+        return false;
+    } else
+      return false;
+    if (*c == ',')
+      c++;
+  }
+  *out = parsed;
+  return true;
+}
+
+// Per-generation summed-area tables, padded by the radius so that no lookup
+// needs a bounds check. Moore counts come from the usual integral image:
+//   box(i, j) = sum of the cells above and left of (i, j).
+// Diamonds come from three tables built by one recurrence each:
+//   cone(i, j) = sum over rows a <= i of cells with |b - j| <= i - a
+//   diag(i, j) = cells (i - k, j - k), anti(i, j) = cells (i - k, j + k)
+// so a diamond is a big cone minus two side cones, plus the diagonal rays
+// those side cones stick out of the big one by, plus the cone both overlap
+// in. Unsigned arithmetic wraps, so a count is exact even if a table entry
+// overflows. Either way a count costs the same for every radius.
+typedef struct {
+  uint32_t *box;
+  uint32_t *cone, *diag, *anti;
+  int rows, cols; // of the tables, padding included
+  int pad;
+} SumTables;
+
+#define SUM_AT(t, table, i, j)                                                 \
+  ((t)->table[(size_t)((i) + (t)->pad) * (t)->cols + (j) + (t)->pad])
+
+SumTables createSumTables(Grid *grid, LtLRule *ltl) {
+  SumTables t;
+  t.pad = ltl->radius + 2;
+  t.rows = grid->rows + 2 * t.pad;
+  t.cols = grid->cols + 2 * t.pad;
+  size_t cells = (size_t)t.rows * t.cols;
+  t.box = (uint32_t *)calloc(cells, sizeof(uint32_t));
+  t.cone = ltl->von_neumann ? (uint32_t *)calloc(cells, sizeof(uint32_t)) : NULL;
+  t.diag = ltl->von_neumann ? (uint32_t *)calloc(cells, sizeof(uint32_t)) : NULL;
+  t.anti = ltl->von_neumann ? (uint32_t *)calloc(cells, sizeof(uint32_t)) : NULL;
+  return t;
+}
+
+void freeSumTables(SumTables *t) {
+  free(t->box);
+  free(t->cone);
+  free(t->diag);
+  free(t->anti);
+}
+
+// fills the tables from the grid; the first padded row and column stay 0
+static void build_sum_tables(Grid *grid, SumTables *t) {
+  const int p = t->pad, w = t->cols;
+  // one grid row, zero padded; rows outside the grid are all dead
+  uint32_t *g = (uint32_t *)calloc(w, sizeof(uint32_t));
+  for (int i = 1 - p; i < t->rows - p; i++) {
+    const int src = i - 1; // box(i, j) covers the cells above row i
+    for (int j = 0; j < grid->cols; j++)
+      g[j + p] = src >= 0 && src < grid->rows ? CELL(grid, src, j) : 0;
+    uint32_t *box = &SUM_AT(t, box, i, -p);
+    const uint32_t *box_up = box - w;
+    uint32_t run = 0;
+    for (int j = 1; j < w; j++) {
+      run += g[j - 1];
+      box[j] = box_up[j] + run;
+    }
+  }
+  if (t->cone) {
+    for (int i = 1 - p; i < t->rows - p; i++) {
+      for (int j = 0; j < grid->cols; j++)
+        g[j + p] = i >= 0 && i < grid->rows ? CELL(grid, i, j) : 0;
+      uint32_t *diag = &SUM_AT(t, diag, i, -p), *anti = &SUM_AT(t, anti, i, -p);
+      uint32_t *cone = &SUM_AT(t, cone, i, -p);
+      const uint32_t *diag_up = diag - w, *anti_up = anti - w;
+      const uint32_t *cone_up = cone - w;
+      for (int j = 1; j < w - 1; j++) {
+        diag[j] = diag_up[j - 1] + g[j];
+        anti[j] = anti_up[j + 1] + g[j];
+        cone[j] = cone_up[j] + g[j] + diag_up[j - 1] + anti_up[j + 1];
+      }
+    }
+  }
+  free(g);
+}
+
+static inline uint32_t moore_count(SumTables *t, int i, int j, int r) {
+  return SUM_AT(t, box, i + r + 1, j + r + 1) - SUM_AT(t, box, i - r, j + r + 1) -
+         SUM_AT(t, box, i + r + 1, j - r) + SUM_AT(t, box, i - r, j - r);
+}
+
+static inline uint32_t diamond_count(SumTables *t, int i, int j, int r) {
+  return SUM_AT(t, cone, i + r, j) - SUM_AT(t, cone, i, j - r - 1) +
+         SUM_AT(t, diag, i, j - r - 1) - SUM_AT(t, cone, i, j + r + 1) +
+         SUM_AT(t, anti, i, j + r + 1) + SUM_AT(t, cone, i - r - 1, j);
+}
+
+// von_neumann is a constant at both call sites, so each gets its own loop
+static inline uint64_t ltl_rows(Grid *grid, Grid *out, LtLRule *ltl,
+                                SumTables *t, bool von_neumann, Stats *stats) {
+  uint64_t hash = 0;
+  const int r = ltl->radius;
+  const unsigned born_span = ltl->born_max - ltl->born_min;
+  const unsigned kept_span = ltl->kept_max - ltl->kept_min;
+  const unsigned self = !ltl->middle;
+  for (int i = 0; i < grid->rows; i++) {
+    const type *row = &CELL(grid, i, 0);
+    type *dst = &CELL(out, i, 0);
+    for (int j = 0; j < grid->cols; j++) {
+      const unsigned count = (von_neumann ? diamond_count(t, i, j, r)
+                                          : moore_count(t, i, j, r)) -
+                             self * row[j];
+      // x in [min, min + span] as one unsigned compare
+      dst[j] = row[j] ? count - ltl->kept_min <= kept_span
+                      : count - ltl->born_min <= born_span;
+    }
+#if CYCLE_PERIOD
+    hash += hash_row(dst, grid->cols, i);
+#endif
+    if (stats)
+      row_stats(row, dst, grid->cols, i, stats);
+  }
+  return hash;
+}
+
+uint64_t updateGridLtL(Grid *grid, Grid *out, LtLRule *ltl, SumTables *t,
+                       Stats *stats) {
+  build_sum_tables(grid, t);
+  return ltl->von_neumann ? ltl_rows(grid, out, ltl, t, true, stats)
+                          : ltl_rows(grid, out, ltl, t, false, stats);
+}
+
+// Out of core: the grid lives in a memory-mapped file, and a generation
+// streams it through three bands of MAPPED_BAND rows (the band being updated
+// and the ones above and below it) into a second file, written a band at a
+// time. That is one sequential read and one sequential write of the grid per
+// generation, and only the bands have to fit in memory. File rows are cols
+// cells with no border.
+#ifndef MAPPED_FILE
+#define MAPPED_FILE "out/grid.bin" // the last generation ends up here
+#endif
+
+#ifndef MAPPED_BAND
+#define MAPPED_BAND 256 // rows per band
+#endif
+
+typedef struct {
+  type *cells; // rows * cols cells, mapped read-only
+  int fd;
+  int rows, cols;
+  const char *path;
+} MappedGrid;
+
+// rows [top, top + n) of grid from band, packed without a border
+static void write_band(MappedGrid *grid, const type *band, int top, int n) {
+  const char *src = (const char *)band;
+  size_t left = (size_t)n * grid->cols * sizeof(type);
+  off_t at = (off_t)top * grid->cols * sizeof(type);
+  while (left) {
+    const ssize_t done = pwrite(grid->fd, src, left, at);
+    if (done < 0) {
+      perror(grid->path);
+      exit(1);
+    }
+    src += done;
+    left -= done;
+    at += done;
+  }
+}
+
+// density 0 leaves every cell dead
+MappedGrid createMappedGrid(const char *path, int rows, int cols,
+                            uint64_t seed, double density) {
+  MappedGrid grid = {NULL, -1, rows, cols, path};
+  const size_t size = (size_t)rows * cols * sizeof(type);
+  grid.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (grid.fd < 0 || ftruncate(grid.fd, size) != 0) {
+    perror(path);
+    exit(1);
+  }
+  if (density > 0) {
+    // the same cells as randomGrid, a band at a time
+    type *band = (type *)malloc((size_t)MAPPED_BAND * cols * sizeof(type));
+    for (int top = 0; top < rows; top += MAPPED_BAND) {
+      const int n = imin(MAPPED_BAND, rows - top);
+      randomCells(band, (uint64_t)top * cols, (size_t)n * cols, seed, density);
+      write_band(&grid, band, top, n);
+    }
+    free(band);
+  }
+  grid.cells = (type *)mmap(NULL, size, PROT_READ, MAP_SHARED, grid.fd, 0);
+  if (grid.cells == MAP_FAILED) {
+    perror(path);
+    exit(1);
+  }
+  madvise(grid.cells, size, MADV_SEQUENTIAL);
+  return grid;
+}
+
+void freeMappedGrid(MappedGrid *grid) {
+  munmap(grid->cells, (size_t)grid->rows * grid->cols * sizeof(type));
+  close(grid->fd);
+}
+
+void swapMappedGrid(MappedGrid *a, MappedGrid *b) {
+  MappedGrid tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// row i of grid into dst, and with TORUS its wrapped ends into dst's border
+static void load_row(MappedGrid *grid, type *dst, int i) {
+  const type *src = grid->cells + (size_t)i * grid->cols;
+  memcpy(dst, src, grid->cols * sizeof(type));
+#ifdef TORUS
+  dst[-1] = src[grid->cols - 1];
+  dst[grid->cols] = src[0];
+#endif
+}
+
+static void copy_row(Grid *dst, int i, Grid *src, int k) {
+  memcpy(&CELL(dst, i, -1), &CELL(src, k, -1),
+         (dst->cols + 2) * sizeof(type));
+}
+
+// returns the hash of the new generation, and its stats unless stats is NULL
+uint64_t updateMappedGrid(MappedGrid *grid, MappedGrid *out, Stats *stats) {
+  const int rows = grid->rows, cols = grid->cols;
+  const size_t page = sysconf(_SC_PAGESIZE);
+  Grid above = createGrid(MAPPED_BAND, cols, 0);
+  Grid band = createGrid(MAPPED_BAND, cols, 0);
+  Grid below = createGrid(MAPPED_BAND, cols, 0);
+  type *next = (type *)malloc((size_t)MAPPED_BAND * cols * sizeof(type));
+  uint64_t hash = 0;
+#if CYCLE_PERIOD
+  const int words = (cols + 63) / 64;
+  uint64_t *packed = (uint64_t *)malloc(words * sizeof(uint64_t));
+#else
+  uint64_t *packed = NULL;
+#endif
+  size_t dropped = 0; // bytes of the mapping released so far
+
+  int n = imin(MAPPED_BAND, rows);
+  for (int i = 0; i < n; i++)
+    load_row(grid, &CELL(&band, i, 0), i);
+  for (int top = 0; top < rows; top += MAPPED_BAND) {
+    const int m = imin(MAPPED_BAND, rows - top - n); // rows in the band below
+    for (int i = 0; i < m; i++)
+      load_row(grid, &CELL(&below, i, 0), top + n + i);
+
+    // the rows just outside the band come from its neighbours
+    if (top > 0)
+      copy_row(&band, -1, &above, MAPPED_BAND - 1);
+    else
+#ifdef TORUS
+      load_row(grid, &CELL(&band, -1, 0), rows - 1);
+#else
+      memset(&CELL(&band, -1, -1), 0, (cols + 2) * sizeof(type));
+#endif
+    if (m > 0)
+      copy_row(&band, n, &below, 0);
+    else
+#ifdef TORUS
+      load_row(grid, &CELL(&band, n, 0), 0);
+#else
+      memset(&CELL(&band, n, -1), 0, (cols + 2) * sizeof(type));
+#endif
+
+    for (int i = 0; i < n; i++) {
+      type *dst = next + (size_t)i * cols;
+      update_row(&CELL(&band, i - 1, 0), &CELL(&band, i, 0),
+                 &CELL(&band, i + 1, 0), dst, cols, packed);
+#if CYCLE_PERIOD
+      hash += hash_words(packed, words, top + i);
+#endif
+      if (stats)
+        row_stats(&CELL(&band, i, 0), dst, cols, top + i, stats);
+    }
+    write_band(out, next, top, n);
+
+    // the rows above this band are in memory as long as they are needed
+    const size_t done = (size_t)top * cols * sizeof(type) / page * page;
+    if (done > dropped) {
+      madvise((char *)grid->cells + dropped, done - dropped, MADV_DONTNEED);
+      dropped = done;
+    }
+    Grid tmp = above;
+    above = band;
+    band = below;
+    below = tmp;
+    n = m;
+  }
+
+  free(next);
+  free(packed);
+  freeGrid(&above);
+  freeGrid(&band);
+  freeGrid(&below);
+  return hash;
+}
+
+// one CSV line per generation, fully buffered
+FILE *openStats(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  setvbuf(file, NULL, _IOFBF, 1 << 20);
+  fprintf(file, "generation,population,births,deaths,top,left,bottom,right\n");
+  return file;
+}
+
+void writeStats(FILE *file, int generation, Stats *stats) {
+  const bool empty = stats->top > stats->bottom;
+  fprintf(file, "%d,%llu,%llu,%llu,%d,%d,%d,%d\n", generation,
+          (unsigned long long)stats->population,
+          (unsigned long long)stats->births,
+          (unsigned long long)stats->deaths, empty ? -1 : stats->top,
+          empty ? -1 : stats->left, empty ? -1 : stats->bottom,
+          empty ? -1 : stats->right);
+}
+
+// Run-time settings. The macros above are the defaults, overridden by
+// --rows/--cols/--steps/--scale/--seed/--density/--rule on the
+// command line or by "key value" or "key = value" lines in a --config file
+// ('#' comments).
+typedef struct {
+  int rows, cols, steps, scale;
+  uint64_t seed;
+  double density;
+  const char *rule;
+} Config;
+
+Config config = {ROWS, COLS, MAX_STEPS, SCALE, SEED, DENSITY, NULL};
+
+static bool set_option(Config *c, const char *key, const char *value) {
+  if (strcmp(key, "rule") == 0) {
+    c->rule = strdup(value);
+    return c->rule != NULL;
+  }
+  char *end;
+  errno = 0;
+  if (strcmp(key, "seed") == 0) {
+    c->seed = strtoull(value, &end, 0);
+    return end != value && !*end && !errno;
+  }
+  if (strcmp(key, "density") == 0) {
+    c->density = strtod(value, &end);
+    return end != value && !*end && c->density >= 0 && c->density <= 1;
+  }
+  int *field = strcmp(key, "rows") == 0    ? &c->rows
+               : strcmp(key, "cols") == 0  ? &c->cols
+               : strcmp(key, "steps") == 0 ? &c->steps
+               : strcmp(key, "scale") == 0 ? &c->scale
+                                           : NULL;
+  long n = field ? strtol(value, &end, 10) : 0;
+  if (!field || end == value || *end || errno || n < 1 || n > INT_MAX)
+    return false;
+  *field = (int)n;
+  return true;
+}
+
+bool loadConfig(const char *path, Config *c) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+  char line[256], key[64], value[192];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "#\n")] = '\0';
+    for (char *p = line; *p; p++)
+      if (*p == '=')
+        *p = ' ';
+    int fields = sscanf(line, "%63s %191s", key, value);
+    ok = fields <= 0 || (fields == 2 && set_option(c, key, value));
+  }
+  fclose(file);
+  return ok;
+}
+
+// --key value pairs, applied in order so later ones win
+bool parseArgs(int argc, char **argv, Config *c) {
+  for (int a = 1; a < argc; a += 2) {
+    const char *key = argv[a], *value = a + 1 < argc ? argv[a + 1] : NULL;
+    bool ok = value && strncmp(key, "--", 2) == 0 &&
+              (strcmp(key, "--config") == 0 ? loadConfig(value, c)
+                                            : set_option(c, key + 2, value));
+    if (!ok) {
+      fprintf(stderr, "Invalid option: %s %s\n", key, value ? value : "");
+      return false;
+    }
+  }
+  return true;
+}
+
+void draw2file(Grid *grid, int step, unsigned char *data) {
+  const int scale = config.scale, width = config.cols * scale;
+  for (int i = 0; i < config.rows * scale; i++)
+    for (int j = 0; j < width; j++) {
+      unsigned char color = CELL(grid, i / scale, j / scale) * 255;
+      size_t index = ((size_t)i * width + j) * 3;
       data[index + 0] = color;
       data[index + 1] = color;
       data[index + 2] = color;
@@ -88,8 +2246,7 @@ void draw2file(type **grid, int step, unsigned char *data) {
 
   char filename[100];
   sprintf(filename, "out/%d.png", step);
-  stbi_write_png(filename, COLS * SCALE, ROWS * SCALE, 3, data,
-                 COLS * SCALE * 3);
+  stbi_write_png(filename, width, config.rows * scale, 3, data, width * 3);
 }
 
 // #define FFMPEG_PATH "out/ffmpeg.exe"
@@ -119,22 +2276,221 @@ int main(int argc, char **argv) {
   double start = clock();
 
   signal(SIGINT, sigint_handler);
-  type **grid = createGrid(ROWS, COLS, true);
-  type **out = createGrid(ROWS, COLS, false);
+  if (!parseArgs(argc, argv, &config))
+    return 1;
+  const char *rulestring = config.rule                    ? config.rule
+                           : ENGINE == ENGINE_LTL         ? LTL_RULE
+                           : ENGINE == ENGINE_GENERATIONS ? GEN_RULE
+                                                          : RULE;
+  LtLRule ltl;
+  int states = 2;
+  bool parsed = ENGINE == ENGINE_LTL ? parseLtL(rulestring, &ltl)
+                : ENGINE == ENGINE_GENERATIONS
+                    ? parseGenerations(rulestring, &rule, &states)
+                    : parseRule(rulestring, &rule);
+  if (!parsed) {
+    fprintf(stderr, "Invalid rule: %s\n", rulestring);
+    return 1;
+  }
+  if ((ENGINE == ENGINE_HASHLIFE || ENGINE == ENGINE_SPARSE) && rule.table[0]) {
+    fprintf(stderr, "B0 rules need a bounded grid engine\n");
+    return 1;
+  }
+#ifdef STATS
+  if (ENGINE == ENGINE_HASHLIFE || ENGINE == ENGINE_SPARSE ||
+      ENGINE == ENGINE_BLOCKED || ENGINE == ENGINE_GENERATIONS) {
+    fprintf(stderr, "STATS needs an engine that writes every generation's "
+                    "two-state cells\n");
+    return 1;
+  }
+#endif
+#ifdef TORUS
+  if (ENGINE != ENGINE_BYTES && ENGINE != ENGINE_ROWSUM &&
+      ENGINE != ENGINE_TILES && ENGINE != ENGINE_BLOCKED &&
+      ENGINE != ENGINE_MAPPED && ENGINE != ENGINE_INPLACE) {
+    fprintf(stderr, "TORUS needs the bytes, row-sum, tiles, blocked, mapped "
+                    "or in-place engine\n");
+    return 1;
+  }
+#endif
+  printf("Kernel: %s\n", selectRowKernel());
+  // the out-of-core engine keeps its grid in files instead, and the in-place
+  // one needs no second grid
+  const int in_core = ENGINE == ENGINE_MAPPED ? 0 : config.rows;
+  Grid grid = createGrid(in_core, config.cols, 0);
+  randomGrid(&grid, config.seed, config.density);
+  Grid out =
+      createGrid(ENGINE == ENGINE_INPLACE ? 0 : in_core, config.cols, 0);
 
-  const int size = ROWS * COLS * SCALE * SCALE * 3 * sizeof(unsigned char);
-  unsigned char *data = (unsigned char *)malloc(size);
+  unsigned char *data = NULL;
+#ifdef PRINT
+  const size_t size = (size_t)config.rows * config.cols * config.scale *
+                      config.scale * 3 * sizeof(unsigned char);
+  data = (unsigned char *)malloc(size);
+#endif
 
-  for (int i = 0; i < MAX_STEPS && running; i++) {
-    updateGrid(grid, ROWS, COLS, out);
-    swap(&grid, &out);
+  BitGrid bgrid, bout;
+  if (ENGINE == ENGINE_LUT)
+    buildLifeTable();
+  if (ENGINE == ENGINE_BITPACK || ENGINE == ENGINE_LUT) {
+    bgrid = createBitGrid(config.rows, config.cols);
+    bout = createBitGrid(config.rows, config.cols);
+    packGrid(&grid, &bgrid);
+  }
+  HashLife hl;
+  if (ENGINE == ENGINE_HASHLIFE)
+    hl = hashlifeFromGrid(&grid);
+  Tiles tiles;
+  if (ENGINE == ENGINE_TILES)
+    tiles = createTiles(&grid);
+  Sparse sparse;
+  if (ENGINE == ENGINE_SPARSE)
+    sparse = sparseFromGrid(&grid);
+  GenGrid ggrid, gout;
+  if (ENGINE == ENGINE_GENERATIONS) {
+    ggrid = createGenGrid(config.rows, config.cols, states);
+    gout = createGenGrid(config.rows, config.cols, states);
+    packGenGrid(&grid, &ggrid);
+  }
+  SumTables sums;
+  if (ENGINE == ENGINE_LTL)
+    sums = createSumTables(&grid, &ltl);
+  MappedGrid mgrid, mout;
+  if (ENGINE == ENGINE_MAPPED) {
+    mgrid = createMappedGrid(MAPPED_FILE, config.rows, config.cols,
+                             config.seed, config.density);
+    mout = createMappedGrid(MAPPED_FILE ".next", config.rows, config.cols, 0,
+                            0);
+  }
+
+  // the engines that hash what they write
+  const bool hashed = ENGINE != ENGINE_HASHLIFE && ENGINE != ENGINE_SPARSE &&
+                      ENGINE != ENGINE_BLOCKED;
+  History history = {{0}};
+  FILE *stats_file = NULL;
+#ifdef STATS
+  stats_file = openStats(STATS_FILE);
+#endif
+
+  for (int i = 0; i < config.steps && running; i++) {
+#ifdef TORUS
+    if (ENGINE != ENGINE_MAPPED)
+      wrapGrid(&grid);
+#endif
+    uint64_t hash = 0;
+    Stats stats = emptyStats();
+    Stats *tracked = stats_file ? &stats : NULL;
+    switch (ENGINE) {
+    case ENGINE_BITPACK:
+      hash = updateBitGrid(&bgrid, &bout, tracked);
+      swapBitGrid(&bgrid, &bout);
+      break;
+    case ENGINE_LUT:
+      hash = updateBitGridLUT(&bgrid, &bout, tracked);
+      swapBitGrid(&bgrid, &bout);
+      break;
+    case ENGINE_HASHLIFE:
+      hashlifeAdvance(&hl, HL_STEP);
+      break;
+    case ENGINE_SPARSE:
+      updateSparse(&sparse);
+      break;
+    case ENGINE_BLOCKED: {
+      int depth = imin(TB_DEPTH, config.steps - i);
+      updateGridBlocked(&grid, &out, depth);
+      swap(&grid, &out);
+      i += depth - 1; // the loop counts the last one
+      break;
+    }
+    case ENGINE_ROWSUM:
+      hash = updateGridRowSum(&grid, &out, tracked);
+      swap(&grid, &out);
+      break;
+    case ENGINE_TILES:
+      hash = updateGridTiles(&grid, &out, &tiles, tracked);
+      swap(&grid, &out);
+      break;
+    case ENGINE_LTL:
+      hash = updateGridLtL(&grid, &out, &ltl, &sums, tracked);
+      swap(&grid, &out);
+      break;
+    case ENGINE_GENERATIONS:
+      hash = updateGenGrid(&ggrid, &gout);
+      swapGenGrid(&ggrid, &gout);
+      break;
+    case ENGINE_MAPPED:
+      hash = updateMappedGrid(&mgrid, &mout, tracked);
+      swapMappedGrid(&mgrid, &mout);
+      break;
+    case ENGINE_INPLACE:
+      hash = updateGridInPlace(&grid, tracked);
+      break;
+    default:
+      hash = updateGrid(&grid, &out, tracked);
+      swap(&grid, &out);
+    }
 #ifdef PRINT
-    draw2file(grid, i, data);
+    if (ENGINE == ENGINE_BITPACK || ENGINE == ENGINE_LUT)
+      unpackGrid(&bgrid, &grid);
+    if (ENGINE == ENGINE_HASHLIFE)
+      hashlifeToGrid(&hl, &grid);
+    if (ENGINE == ENGINE_SPARSE)
+      sparseToGrid(&sparse, &grid);
+    if (ENGINE == ENGINE_GENERATIONS)
+      unpackGenGrid(&ggrid, &grid);
+    if (ENGINE == ENGINE_MAPPED) {
+      // drawing never reads the border the mapping lacks
+      Grid view = {mgrid.cells, NULL, mgrid.rows, mgrid.cols, mgrid.cols};
+      draw2file(&view, i, data);
+    } else
+      draw2file(&grid, i, data);
 #endif
+    if (stats_file)
+      writeStats(stats_file, i + 1, &stats);
+    const int period = hashed ? checkCycle(&history, hash) : 0;
+    if (period) {
+      printf("Period %d from generation %d\n", period, i + 1 - period);
+      break;
+    }
+  }
+
+  if (ENGINE == ENGINE_BITPACK || ENGINE == ENGINE_LUT) {
+    unpackGrid(&bgrid, &grid);
+    freeBitGrid(&bgrid);
+    freeBitGrid(&bout);
+  }
+  if (ENGINE == ENGINE_TILES)
+    freeTiles(&tiles);
+  if (ENGINE == ENGINE_LTL)
+    freeSumTables(&sums);
+  if (ENGINE == ENGINE_GENERATIONS) {
+    unpackGenGrid(&ggrid, &grid);
+    freeGenGrid(&ggrid);
+    freeGenGrid(&gout);
+  }
+  if (ENGINE == ENGINE_MAPPED) {
+    freeMappedGrid(&mgrid);
+    freeMappedGrid(&mout);
+    if (strcmp(mgrid.path, MAPPED_FILE) != 0)
+      rename(mgrid.path, MAPPED_FILE);
+    else
+      remove(mout.path);
+  }
+  if (ENGINE == ENGINE_SPARSE) {
+    sparseToGrid(&sparse, &grid);
+    printf("Population: %zu\n", sparse.count);
+    freeSparse(&sparse);
+  }
+  if (ENGINE == ENGINE_HASHLIFE) {
+    hashlifeToGrid(&hl, &grid);
+    printf("Generation: %llu, nodes: %zu\n",
+           (unsigned long long)hl.generation, hl_nodes);
   }
 
-  freeGrid(grid, ROWS);
-  freeGrid(out, ROWS);
+  if (stats_file)
+    fclose(stats_file);
+  freeGrid(&grid);
+  freeGrid(&out);
   free(data);
 
   double end = clock();
@@ -1,110 +1,857 @@
+#define _GNU_SOURCE // CPU affinity
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include <mpi.h>
 #include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
 
 bool running = true;
 void sigint_handler(int sig) { running = false; }
 
 // #define PRINT
+// #define STATS // per-generation population, births, deaths and bounding box
+#ifndef STATS_FILE
+#define STATS_FILE "out/stats.csv"
+#endif
+// #define TORUS // edges wrap around instead of reading dead cells past them
 
-#define type int
+#define type bool
+#define MPI_CELL MPI_C_BOOL
 #define ROWS 720
 #define COLS 1280
-#define CELLS ROWS *COLS
 #define MAX_STEPS 200
 #define SCALE 1
+#define THREADS 0 // 0: one per core the rank may run on (see placeThreads)
+
+// where the threads run
+#define PIN_NONE 0    // wherever the scheduler puts them
+#define PIN_COMPACT 1 // thread k on the core after thread k - 1's
+#define PIN_SCATTER 2 // round robin over the sockets
+
+#ifndef PIN
+#define PIN PIN_COMPACT
+#endif
+// 1 counts and fills SMT siblings like cores; 0 puts one thread per core and
+// goes on to the siblings only when there are more threads than cores
+#ifndef SMT
+#define SMT 0
+#endif
+
+// rows are padded to a multiple of GRID_ALIGN bytes
+#ifndef GRID_ALIGN
+#define GRID_ALIGN 64
+#endif
 
+// One contiguous, GRID_ALIGN-aligned block with a one-cell ghost border that
+// reads as dead unless exchangeHalo fills it. Cell (i, j) is at
+// cells[i * stride + j] for i in [-1, rows] and j in [-1, cols].
 typedef struct {
-  type *grid;
+  type *cells;
+  void *block;
   int rows;
   int cols;
-  type *out;
-  int start_row;
-  int end_row;
-  int thread_num;
-} ThreadArgs;
+  int stride;
+  size_t bytes; // mapped at block
+  size_t page;  // size of the pages behind it
+} Grid;
+
+// in 64 bits: rows * stride outgrows int long before it outgrows memory
+#define CELL(g, i, j) ((g)->cells[(int64_t)(i) * (g)->stride + (j)])
+
+// rulestring used unless --rule is given, e.g. B36/S23 (HighLife), B2/S (Seeds)
+#ifndef RULE
+#define RULE "B3/S23"
+#endif
+
+// A Life-like rule compiled from its rulestring. table[9 * alive + neighbors]
+// is the next state. The kernels look it up by the 3x3 sum s they compute,
+// cell included: born[s] for dead cells and kept[s] for live ones, padded to
+// 16 entries for byte shuffles, plus the list of sums that set each.
+typedef struct {
+  uint8_t table[18];
+  uint8_t born[16];
+  uint8_t kept[16];
+  uint8_t born_sums[9];
+  uint8_t kept_sums[9];
+  int born_count;
+  int kept_count;
+} Rule;
+
+Rule rule;
+
+// parses "B3/S23" style rulestrings (either part may come first or be empty)
+bool parseRule(const char *rulestring, Rule *out) {
+  Rule parsed = {{0}};
+  int part = 0;
+  for (const char *c = rulestring; *c; c++) {
+    if (*c == 'B' || *c == 'b')
+      part = 'B';
+    else if (*c == 'S' || *c == 's')
+      part = 'S';
+    else if (*c >= '0' && *c <= '8' && part)
+      parsed.table[(part == 'S') * 9 + *c - '0'] = 1;
+    else if (*c != '/')
+      return false;
+  }
+
+  for (int n = 0; n <= 8; n++) {
+    parsed.born[n] = parsed.table[n];
+    parsed.kept[n + 1] = parsed.table[9 + n];
+    if (parsed.table[n])
+      parsed.born_sums[parsed.born_count++] = n;
+    if (parsed.table[9 + n])
+      parsed.kept_sums[parsed.kept_count++] = n + 1;
+  }
+  *out = parsed;
+  return true;
+}
+
+// no bounds checks: the ghost border covers i - 1, i + 1, j - 1 and j + 1
+static inline int count_neighbors(const type *up, const type *row,
+                                  const type *down, int j) {
+  return up[j - 1] + up[j] + up[j + 1] + row[j - 1] + row[j] + row[j + 1] +
+         down[j - 1] + down[j] + down[j + 1];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+// One row of the rule on byte cells. The vertical sums of the columns left
+// of, at and right of each cell add up to its 3x3 block, self included, and
+// the next state is looked up from that sum: no branches, one byte a lane.
+// dst must not alias the input rows: a width that is not a multiple of the
+// vector width ends on one vector overlapping the previous one instead of a
+// cell-by-cell tail, which otherwise costs 2-10x per cell on odd widths.
+// When packed is not NULL the new cells also go there as bits, cell j at bit
+// j % 64 of packed[j / 64], taken from the vectors as they are stored, so
+// the row can be hashed (see hash_words) without reading it again.
+typedef void (*RowKernel)(const type *up, const type *row, const type *down,
+                          type *dst, int cols, uint64_t *packed);
 
-int count_neighbors(type *grid, int rows, int cols, int i, int j) {
-  int neighbors = 0;
-  for (int di = -1; di <= 1; di++)
-    for (int dj = -1; dj <= 1; dj++) {
-      int ni = i + di;
-      int nj = j + dj;
-      if (ni < 0 || ni >= rows || nj < 0 || nj >= cols)
-        continue;
-      neighbors += grid[ni * cols + nj];
+// cells [j, cols), word holding the packed cells [j & ~63, j) before them
+static void update_row_from(const type *up, const type *row,
+                            const type *down, type *dst, int j, int cols,
+                            uint64_t word, uint64_t *packed) {
+  for (; j < cols; j++) {
+    dst[j] = rule.table[count_neighbors(up, row, down, j) + 8 * row[j]];
+    word |= (uint64_t)dst[j] << (j & 63);
+    if (packed && (j & 63) == 63) {
+      packed[j >> 6] = word;
+      word = 0;
     }
-  return neighbors;
-}
-
-void updateGrid(type *grid, int rows, int cols, type *out) {
-  for (int i = 0; i < rows; i++)
-    for (int j = 0; j < cols; j++) {
-      int neighbors = count_neighbors(grid, rows, cols, i, j);
-      neighbors -= grid[i * cols + j];
-      if (grid[i * cols + j] && (neighbors < 2 || neighbors > 3))
-        out[i * cols + j] = false;
-      else if (!grid[i * cols + j] && neighbors == 3)
-        out[i * cols + j] = true;
-      else
-        out[i * cols + j] = grid[i * cols + j];
+  }
+  if (packed && (cols & 63))
+    packed[cols >> 6] = word;
+}
+
+static void update_row_scalar(const type *up, const type *row,
+                              const type *down, type *dst, int cols,
+                              uint64_t *packed) {
+  update_row_from(up, row, down, dst, 0, cols, 0, packed);
+}
+
+#ifdef X86_SIMD
+__attribute__((target("sse2"))) static inline __m128i
+column_sum_sse2(const type *up, const type *row, const type *down, int j) {
+  return _mm_add_epi8(
+      _mm_add_epi8(_mm_loadu_si128((const __m128i *)(up + j)),
+                   _mm_loadu_si128((const __m128i *)(row + j))),
+      _mm_loadu_si128((const __m128i *)(down + j)));
+}
+
+// SSE2 has no byte shuffle, so the sums of the rule are matched one by one.
+// Returns the new cells as a bit mask.
+__attribute__((target("sse2"))) static inline unsigned
+cells_sse2(const type *up, const type *row, const type *down, type *dst,
+           int j) {
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i sum = _mm_add_epi8(
+      _mm_add_epi8(column_sum_sse2(up, row, down, j - 1),
+                   column_sum_sse2(up, row, down, j)),
+      column_sum_sse2(up, row, down, j + 1));
+  __m128i alive =
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(row + j)), one);
+  __m128i born = _mm_setzero_si128(), kept = _mm_setzero_si128();
+  for (int k = 0; k < rule.born_count; k++)
+    born = _mm_or_si128(born,
+                        _mm_cmpeq_epi8(sum, _mm_set1_epi8(rule.born_sums[k])));
+  for (int k = 0; k < rule.kept_count; k++)
+    kept = _mm_or_si128(kept,
+                        _mm_cmpeq_epi8(sum, _mm_set1_epi8(rule.kept_sums[k])));
+  __m128i live = _mm_or_si128(_mm_andnot_si128(alive, born),
+                              _mm_and_si128(alive, kept));
+  _mm_storeu_si128((__m128i *)(dst + j), _mm_and_si128(live, one));
+  return _mm_movemask_epi8(live);
+}
+
+// The last, overlapping vector repeats cells below j; only its top cols - j
+// mask bits are new.
+__attribute__((target("sse2"))) static void
+update_row_sse2(const type *up, const type *row, const type *down, type *dst,
+                int cols, uint64_t *packed) {
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 16 <= cols; j += 16) {
+    word |= (uint64_t)cells_sse2(up, row, down, dst, j) << (j & 63);
+    if (packed && (j & 63) == 48) {
+      packed[j >> 6] = word;
+      word = 0;
+    }
+  }
+  if (j < cols && cols >= 16) {
+    const unsigned mask = cells_sse2(up, row, down, dst, cols - 16);
+    word |= (uint64_t)(mask >> (16 - (cols - j))) << (j & 63);
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+column_sum_avx2(const type *up, const type *row, const type *down, int j) {
+  return _mm256_add_epi8(
+      _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(up + j)),
+                      _mm256_loadu_si256((const __m256i *)(row + j))),
+      _mm256_loadu_si256((const __m256i *)(down + j)));
+}
+
+// returns the new cells as a bit mask: their 1s shifted up to each sign bit
+__attribute__((target("avx2"))) static inline unsigned
+cells_avx2(const type *up, const type *row, const type *down, type *dst, int j,
+           __m256i born, __m256i kept) {
+  __m256i sum = _mm256_add_epi8(
+      _mm256_add_epi8(column_sum_avx2(up, row, down, j - 1),
+                      column_sum_avx2(up, row, down, j)),
+      column_sum_avx2(up, row, down, j + 1));
+  __m256i alive = _mm256_cmpeq_epi8(
+      _mm256_loadu_si256((const __m256i *)(row + j)), _mm256_set1_epi8(1));
+  __m256i next = _mm256_blendv_epi8(_mm256_shuffle_epi8(born, sum),
+                                    _mm256_shuffle_epi8(kept, sum), alive);
+  _mm256_storeu_si256((__m256i *)(dst + j), next);
+  return (unsigned)_mm256_movemask_epi8(_mm256_slli_epi16(next, 7));
+}
+
+__attribute__((target("avx2"))) static void
+update_row_avx2(const type *up, const type *row, const type *down, type *dst,
+                int cols, uint64_t *packed) {
+  const __m256i born = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)rule.born));
+  const __m256i kept = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)rule.kept));
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 32 <= cols; j += 32) {
+    const unsigned mask = cells_avx2(up, row, down, dst, j, born, kept);
+    word |= (uint64_t)mask << (j & 63);
+    if (packed && (j & 63) == 32) {
+      packed[j >> 6] = word;
+      word = 0;
     }
+  }
+  if (j < cols && cols >= 32) {
+    const unsigned mask = cells_avx2(up, row, down, dst, cols - 32, born, kept);
+    word |= (uint64_t)(mask >> (32 - (cols - j))) << (j & 63);
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
 }
 
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i
+column_sum_avx512(const type *up, const type *row, const type *down, int j) {
+  return _mm512_add_epi8(
+      _mm512_add_epi8(_mm512_loadu_si512(up + j), _mm512_loadu_si512(row + j)),
+      _mm512_loadu_si512(down + j));
+}
+
+// returns the new cells as a bit mask
+__attribute__((target("avx512f,avx512bw"))) static inline uint64_t
+cells_avx512(const type *up, const type *row, const type *down, type *dst,
+             int j, __m512i born, __m512i kept) {
+  __m512i sum = _mm512_add_epi8(
+      _mm512_add_epi8(column_sum_avx512(up, row, down, j - 1),
+                      column_sum_avx512(up, row, down, j)),
+      column_sum_avx512(up, row, down, j + 1));
+  __mmask64 alive = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row + j),
+                                           _mm512_set1_epi8(1));
+  __m512i next = _mm512_mask_blend_epi8(alive, _mm512_shuffle_epi8(born, sum),
+                                        _mm512_shuffle_epi8(kept, sum));
+  _mm512_storeu_si512(dst + j, next);
+  return _mm512_test_epi8_mask(next, next);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void
+update_row_avx512(const type *up, const type *row, const type *down,
+                  type *dst, int cols, uint64_t *packed) {
+  const __m512i born = _mm512_broadcast_i32x4(
+      _mm_loadu_si128((const __m128i *)rule.born));
+  const __m512i kept = _mm512_broadcast_i32x4(
+      _mm_loadu_si128((const __m128i *)rule.kept));
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 64 <= cols; j += 64) {
+    const uint64_t mask = cells_avx512(up, row, down, dst, j, born, kept);
+    if (packed)
+      packed[j >> 6] = mask;
+  }
+  if (j < cols && cols >= 64) {
+    word = cells_avx512(up, row, down, dst, cols - 64, born, kept) >>
+           (64 - (cols - j));
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+#endif
+
+RowKernel update_row = update_row_scalar;
+
+// picks the widest kernel this CPU supports, via CPUID
+const char *selectRowKernel() {
+#ifdef X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    update_row = update_row_avx512;
+    return "avx512";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    update_row = update_row_avx2;
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    update_row = update_row_sse2;
+    return "sse2";
+  }
+#endif
+  update_row = update_row_scalar;
+  return "scalar";
+}
+
+// Per-generation statistics, gathered while each row is still in cache right
+// after it is written. The bounding box is inclusive; top > bottom when
+// nothing is alive.
+typedef struct {
+  uint64_t population;
+  uint64_t births;
+  uint64_t deaths;
+  int top, left, bottom, right;
+} Stats;
+
+Stats emptyStats() {
+  Stats stats = {0, 0, 0, INT_MAX, INT_MAX, -1, -1};
+  return stats;
+}
+
+// adds row i, which went from prev to next, to stats
+static inline void row_stats(const type *prev, const type *next, int cols,
+                             int i, Stats *stats) {
+  const unsigned char *restrict a = (const unsigned char *)prev;
+  const unsigned char *restrict b = (const unsigned char *)next;
+  unsigned population = 0, births = 0, deaths = 0;
+  for (int j = 0; j < cols; j++) {
+    population += b[j];
+    births += b[j] & (a[j] ^ 1);
+    deaths += a[j] & (b[j] ^ 1);
+  }
+  stats->population += population;
+  stats->births += births;
+  stats->deaths += deaths;
+  if (population) {
+    int left = 0, right = cols - 1;
+    while (!b[left])
+      left++;
+    while (!b[right])
+      right--;
+    stats->top = i < stats->top ? i : stats->top;
+    stats->bottom = i;
+    stats->left = left < stats->left ? left : stats->left;
+    stats->right = right > stats->right ? right : stats->right;
+  }
+}
+
+// combines the partial stats of two disjoint parts of a generation
+void mergeStats(Stats *into, const Stats *part) {
+  into->population += part->population;
+  into->births += part->births;
+  into->deaths += part->deaths;
+  into->top = part->top < into->top ? part->top : into->top;
+  into->left = part->left < into->left ? part->left : into->left;
+  into->bottom = part->bottom > into->bottom ? part->bottom : into->bottom;
+  into->right = part->right > into->right ? part->right : into->right;
+}
+
+// Early stop: every generation is hashed while it is written, and one whose
+// hash matches the generation p steps back repeats with period p. Periods up
+// to CYCLE_PERIOD are found. The row kernels hand over the cells they store
+// already packed, so hashing reads nothing again; -DCYCLE_PERIOD=0 turns it
+// off.
+#ifndef CYCLE_PERIOD
+#define CYCLE_PERIOD 8
+#endif
+
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t h) {
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+// Hash of row i as n words. A generation hashes to the sum over its rows, so
+// threads and ranks add up their own rows in any order.
+static inline uint64_t hash_words(const uint64_t *words, int n, int i) {
+  uint64_t h = mix64(i + 1);
+  for (int w = 0; w < n; w++)
+    h = (h ^ words[w]) * 0x9e3779b97f4a7c15ULL;
+  return mix64(h);
+}
+
+// a ring of the last generation hashes
+typedef struct {
+  uint64_t hashes[CYCLE_PERIOD + 1];
+  long count;
+} History;
+
+// records a generation's hash and returns its period, or 0 if it is new
+int checkCycle(History *history, uint64_t hash) {
+  int period = 0;
+  for (int p = 1; p <= CYCLE_PERIOD && p <= history->count && !period; p++)
+    if (history->hashes[(history->count - p) % (CYCLE_PERIOD + 1)] == hash)
+      period = p;
+  history->hashes[history->count++ % (CYCLE_PERIOD + 1)] = hash;
+  return period;
+}
+
+// returns the hash of the rows written, and adds them to stats unless NULL
+uint64_t updateRows(Grid *grid, Grid *out, int start_row, int end_row,
+                    Stats *stats) {
+  uint64_t hash = 0;
+#if CYCLE_PERIOD
+  const int words = (grid->cols + 63) / 64;
+  uint64_t *packed = (uint64_t *)malloc(words * sizeof(uint64_t));
+#else
+  uint64_t *packed = NULL;
+#endif
+  for (int i = start_row; i < end_row; i++) {
+    update_row(&CELL(grid, i - 1, 0), &CELL(grid, i, 0), &CELL(grid, i + 1, 0),
+               &CELL(out, i, 0), grid->cols, packed);
+#if CYCLE_PERIOD
+    hash += hash_words(packed, words, i);
+#endif
+    if (stats)
+      row_stats(&CELL(grid, i, 0), &CELL(out, i, 0), grid->cols, i, stats);
+  }
+  free(packed);
+  return hash;
+}
+
+uint64_t updateGrid(Grid *grid, Grid *out, Stats *stats) {
+  return updateRows(grid, out, 0, grid->rows, stats);
+}
+
+// Seeded, counter-based initial cells: cell n, counting row-major over the
+// whole grid, is alive when byte n % 8 of mix64(key + n / 8) is below
+// density * 256. Any thread or rank can draw any run of cells, and a seed
+// gives the same grid however the work is split.
+#ifndef SEED
+#define SEED 1
+#endif
+
+#ifndef DENSITY
+#define DENSITY 0.5 // of live cells, in steps of 1/256
+#endif
+
+static inline type random_cell(uint64_t key, uint64_t n, unsigned threshold) {
+  return (mix64(key + n / 8) >> n % 8 * 8 & 0xff) < threshold;
+}
+
+// cells [0, count) of dst become cells [n, n + count) of the grid
+void randomCells(type *dst, uint64_t n, size_t count, uint64_t seed,
+                 double density) {
+  const uint64_t key = mix64(seed);
+  const unsigned threshold = (unsigned)(density * 256 + 0.5);
+  size_t k = 0;
+  for (; k < count && (n + k) % 8; k++)
+    dst[k] = random_cell(key, n + k, threshold);
+  // one hash per 8 cells
+  for (; k + 8 <= count; k += 8) {
+    const uint64_t bits = mix64(key + (n + k) / 8);
+    for (int b = 0; b < 8; b++)
+      dst[k + b] = (bits >> 8 * b & 0xff) < threshold;
+  }
+  for (; k < count; k++)
+    dst[k] = random_cell(key, n + k, threshold);
+}
+
+// rows [start, end) of band i of n over rows rows, the larger bands first
+static void band_rows(int rows, int n, int i, int *start, int *end) {
+  const int extra = rows % n;
+  *start = i * (rows / n) + (i < extra ? i : extra);
+  *end = *start + rows / n + (i < extra);
+}
+
+// Grid memory is mapped directly: 1 GB or 2 MB pages when the grid spans at
+// least one and the kernel has them reserved (vm.nr_hugepages), otherwise
+// normal pages with transparent huge pages asked for. Nothing is written
+// here, so each page lands on the NUMA node of the thread that first touches
+// it, which touchGrid arranges to be the thread that updates it.
+#ifndef HUGE_PAGES
+#define HUGE_PAGES 1 // 0 for normal pages only
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// maps at least *bytes, and returns the size mapped and of its pages
+static void *map_cells(size_t *bytes, size_t *page) {
+  const int shifts[] = {30, 21};
+  for (int k = 0; HUGE_PAGES && k < 2; k++) {
+    const size_t size = (size_t)1 << shifts[k];
+    if (*bytes < size)
+      continue;
+    const size_t rounded = (*bytes + size - 1) / size * size;
+    void *block = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                           shifts[k] << MAP_HUGE_SHIFT,
+                       -1, 0);
+    if (block != MAP_FAILED) {
+      *bytes = rounded;
+      *page = size;
+      return block;
+    }
+  }
+
+  *page = sysconf(_SC_PAGESIZE);
+  *bytes = (*bytes + *page - 1) / *page * *page;
+  void *block = mmap(NULL, *bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+#if HUGE_PAGES && defined(MADV_HUGEPAGE)
+  madvise(block, *bytes, MADV_HUGEPAGE);
+#endif
+  return block;
+}
+
+// One CPU of the affinity mask, and where it sits: sockets and cores are
+// numbered in the order found, siblings within their core.
+typedef struct {
+  int cpu;
+  int package;
+  int core;    // across all packages
+  int in_core; // SMT sibling number
+  int in_package;
+  int core_id; // as the kernel reports it
+} Slot;
+
+// the CPUs threads are pinned to, thread k on cpus[k % num_cpus]
+int *cpus = NULL;
+int num_cpus = 0;
+
+static int read_topology(int cpu, const char *what) {
+  char path[96];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+           cpu, what);
+  FILE *file = fopen(path, "r");
+  int value = -1;
+  if (file) {
+    if (fscanf(file, "%d", &value) != 1)
+      value = -1;
+    fclose(file);
+  }
+  return value;
+}
+
+static int by_topology(const void *a, const void *b) {
+  const Slot *x = (const Slot *)a, *y = (const Slot *)b;
+  if (x->package != y->package)
+    return x->package - y->package;
+  if (x->core_id != y->core_id)
+    return x->core_id - y->core_id;
+  return x->cpu - y->cpu;
+}
+
+static int by_policy(const void *a, const void *b) {
+  const Slot *x = (const Slot *)a, *y = (const Slot *)b;
+  const int first[] = {SMT ? 0 : x->in_core - y->in_core,
+                       PIN == PIN_SCATTER ? x->in_core - y->in_core : 0,
+                       PIN == PIN_SCATTER ? x->in_package - y->in_package
+                                          : x->core - y->core,
+                       PIN == PIN_SCATTER ? x->package - y->package
+                                          : x->in_core - y->in_core};
+  for (int k = 0; k < 4; k++)
+    if (first[k])
+      return first[k];
+  return 0;
+}
+
+// Lays the threads out on the CPUs of mask, keeping the cores of part
+// [part, part + 1) of parts when processes share the mask, and returns how
+// many threads that calls for: its cores, or with SMT its CPUs. cpus lists
+// them in pinning order, siblings last unless SMT, so that extra threads go
+// to idle siblings before doubling up on a CPU.
+int placeThreads(const cpu_set_t *mask, int part, int parts) {
+  Slot *slots = (Slot *)malloc(CPU_COUNT(mask) * sizeof(Slot));
+  int n = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, mask)) {
+      slots[n].cpu = cpu;
+      slots[n].package = read_topology(cpu, "physical_package_id");
+      slots[n].core_id = read_topology(cpu, "core_id");
+      // without sysfs every CPU is a core of its own
+      if (slots[n].package < 0 || slots[n].core_id < 0) {
+        slots[n].package = 0;
+        slots[n].core_id = cpu;
+      }
+      n++;
+    }
+  qsort(slots, n, sizeof(Slot), by_topology);
+
+  int cores = 0, packages = 0;
+  for (int k = 0; k < n; k++) {
+    const bool new_package = k == 0 || slots[k].package != slots[k - 1].package;
+    const bool new_core = new_package || slots[k].core_id != slots[k - 1].core_id;
+    packages += new_package;
+    cores += new_core;
+    slots[k].core = cores - 1;
+    slots[k].in_core = new_core ? 0 : slots[k - 1].in_core + 1;
+    slots[k].in_package =
+        new_package ? 0 : slots[k - 1].in_package + new_core;
+  }
+
+  // this part's cores, which are consecutive in slots; with more parts than
+  // cores, the one core it would share
+  const int first = part * cores / parts;
+  int last = (part + 1) * cores / parts;
+  if (last == first && first < cores)
+    last = first + 1;
+  int kept = 0;
+  for (int k = 0; k < n; k++)
+    if (slots[k].core >= first && slots[k].core < last)
+      slots[kept++] = slots[k];
+  qsort(slots, kept, sizeof(Slot), by_policy);
+
+  free(cpus);
+  cpus = (int *)malloc(kept * sizeof(int));
+  num_cpus = kept;
+  for (int k = 0; k < kept; k++)
+    cpus[k] = slots[k].cpu;
+  free(slots);
+  return SMT ? kept : last - first;
+}
+
+// attributes pinning a new thread k to its CPU
+static void pinned_attr(pthread_attr_t *attr, int k) {
+  pthread_attr_init(attr);
+  if (PIN != PIN_NONE && num_cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[k % num_cpus], &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+  }
+}
+
+typedef struct {
+  Grid *grid;
+  int start, end; // rows, the border rows belong to the first and last band
+} TouchArgs;
+
+// the rows [start, end) of band i as parallelUpdateGrid hands them out, in
+// units of unit rows
+static void touch_rows(Grid *grid, int num_threads, int unit, int i,
+                       int *start, int *end) {
+  band_rows((grid->rows + unit - 1) / unit, num_threads, i, start, end);
+  *start = *start * unit < grid->rows ? *start * unit : grid->rows;
+  *end = *end * unit < grid->rows ? *end * unit : grid->rows;
+}
+
+static void *touch_band(void *arguments) {
+  TouchArgs *args = (TouchArgs *)arguments;
+  Grid *grid = args->grid;
+  memset(&CELL(grid, args->start, -1), 0,
+         (size_t)(args->end - args->start) * grid->stride * sizeof(type));
+  return NULL;
+}
+
+// zeroes each band of the grid from its own thread
+void touchGrid(Grid *grid, int num_threads, int unit) {
+  pthread_t threads[num_threads];
+  TouchArgs args[num_threads];
+  for (int i = 0; i < num_threads; i++) {
+    args[i].grid = grid;
+    touch_rows(grid, num_threads, unit, i, &args[i].start, &args[i].end);
+    if (i == 0)
+      args[i].start = -1;
+    if (i == num_threads - 1)
+      args[i].end = grid->rows + 1;
+    pthread_attr_t attr;
+    pinned_attr(&attr, i);
+    pthread_create(&threads[i], &attr, touch_band, (void *)&args[i]);
+    pthread_attr_destroy(&attr);
+  }
+  for (int i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+}
+
+#define MAX_NODES 64
+
+// prints how many of the grid's pages each NUMA node holds, and the node
+// holding most of each thread's band
+void reportPlacement(Grid *grid, int num_threads, int unit) {
+  long per_node[MAX_NODES] = {0};
+  int homes[num_threads];
+  uintptr_t counted = 0; // pages below were counted with an earlier band
+  for (int i = 0; i < num_threads; i++) {
+    int start, end;
+    touch_rows(grid, num_threads, unit, i, &start, &end);
+    long band[MAX_NODES] = {0};
+    uintptr_t from = (uintptr_t)&CELL(grid, start, -1) / grid->page;
+    from *= grid->page;
+    const uintptr_t to = (uintptr_t)&CELL(grid, end, -1);
+    while (from < to) {
+      void *pages[256];
+      int status[256];
+      int n = 0;
+      for (; n < 256 && from < to; n++, from += grid->page)
+        pages[n] = (void *)from;
+      if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) {
+        printf("Page placement unknown: %s\n", strerror(errno));
+        return;
+      }
+      for (int k = 0; k < n; k++)
+        if (status[k] >= 0 && status[k] < MAX_NODES) {
+          band[status[k]]++;
+          per_node[status[k]] += (uintptr_t)pages[k] >= counted;
+        }
+    }
+    counted = from > counted ? from : counted;
+    homes[i] = -1;
+    for (int node = 0; node < MAX_NODES; node++)
+      if (band[node] && (homes[i] < 0 || band[node] > band[homes[i]]))
+        homes[i] = node;
+  }
+
+  printf("Pages of %zu KB per node:", grid->page >> 10);
+  for (int node = 0; node < MAX_NODES; node++)
+    if (per_node[node])
+      printf(" %d: %ld", node, per_node[node]);
+  printf("\nNode of each thread's band:");
+  for (int i = 0; i < num_threads; i++)
+    printf(" %d", homes[i]);
+  printf("\n");
+}
+
+// stride is in cells, 0 picks cols + 2 rounded up to GRID_ALIGN bytes
+Grid createGrid(int rows, int cols, int stride) {
+  const int per_line = GRID_ALIGN / sizeof(type);
+  if (stride < cols + 2)
+    stride = (cols + 2 + per_line - 1) / per_line * per_line;
+
+  Grid grid;
+  grid.rows = rows;
+  grid.cols = cols;
+  grid.stride = stride;
+  grid.bytes = (size_t)(rows + 2) * stride * sizeof(type) + GRID_ALIGN;
+  grid.block = map_cells(&grid.bytes, &grid.page);
+  // align cell (0, 0) so every row starts on a GRID_ALIGN boundary when the
+  // stride is a multiple of it
+  uintptr_t first = (uintptr_t)grid.block + (stride + 1) * sizeof(type);
+  uintptr_t pad = (GRID_ALIGN - first % GRID_ALIGN) % GRID_ALIGN;
+  grid.cells = (type *)(first + pad);
+  return grid;
+}
+
+void freeGrid(Grid *grid) { munmap(grid->block, grid->bytes); }
+
+// Fills the ghost columns with the edge columns of the neighboring ranks, so
+// the column blocks join up; `edge` is one column of the local grid. With
+// TORUS the first and last rank are neighbors as well, and the ghost rows
+// wrap around within each rank, corners included.
+void exchangeHalo(Grid *grid, MPI_Datatype edge, int rank, int size) {
+#ifdef TORUS
+  const int left = (rank + size - 1) % size, right = (rank + 1) % size;
+#else
+  const int left = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+  const int right = rank + 1 < size ? rank + 1 : MPI_PROC_NULL;
+#endif
+  MPI_Sendrecv(&CELL(grid, 0, grid->cols - 1), 1, edge, right, 0,
+               &CELL(grid, 0, -1), 1, edge, left, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+  MPI_Sendrecv(&CELL(grid, 0, 0), 1, edge, left, 1, &CELL(grid, 0, grid->cols),
+               1, edge, right, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+#ifdef TORUS
+  memcpy(&CELL(grid, -1, -1), &CELL(grid, grid->rows - 1, -1),
+         (grid->cols + 2) * sizeof(type));
+  memcpy(&CELL(grid, grid->rows, -1), &CELL(grid, 0, -1),
+         (grid->cols + 2) * sizeof(type));
+#endif
+}
+
+typedef struct {
+  Grid *grid;
+  Grid *out;
+  int start_row;
+  int end_row;
+  int thread_num;
+  uint64_t hash; // of the rows written
+  Stats stats;   // of the rows written, when stats are kept
+  bool keep_stats;
+} ThreadArgs;
+
 // Thread function
 void *updateGridThread(void *arguments) {
   ThreadArgs *args = (ThreadArgs *)arguments;
   printf("I'm the Posix Thread N.%d\n", args->thread_num);
 
-  for (int i = args->start_row; i < args->end_row; i++) {
-    for (int j = 0; j < args->cols; j++) {
-      int neighbors = count_neighbors(args->grid, args->rows, args->cols, i, j);
-      neighbors -= args->grid[i * args->cols + j];
-
-      if (args->grid[i * args->cols + j] && (neighbors < 2 || neighbors > 3))
-        args->out[i * args->cols + j] = false;
-      else if (!args->grid[i * args->cols + j] && neighbors == 3)
-        args->out[i * args->cols + j] = true;
-      else
-        args->out[i * args->cols + j] = args->grid[i * args->cols + j];
-    }
-  }
+  args->stats = emptyStats();
+  args->hash = updateRows(args->grid, args->out, args->start_row,
+                          args->end_row, args->keep_stats ? &args->stats : NULL);
 
   pthread_exit(NULL);
 }
 
 // Parallelized updateGrid function
-void parallelUpdateGrid(type *grid, int rows, int cols, type *out, int num_threads) {
+// returns the hash of the rows written, and their stats unless stats is NULL
+uint64_t parallelUpdateGrid(Grid *grid, Grid *out, int num_threads,
+                            Stats *stats) {
   pthread_t threads[num_threads];
   ThreadArgs threadArgs[num_threads];
 
-  int rows_per_thread = rows / num_threads;
-  int remaining_rows = rows % num_threads;
-  int current_row = 0;
-
   for (int i = 0; i < num_threads; i++) {
     threadArgs[i].grid = grid;
-    threadArgs[i].rows = rows;
-    threadArgs[i].cols = cols;
     threadArgs[i].out = out;
-    threadArgs[i].start_row = current_row;
-    threadArgs[i].end_row = current_row + rows_per_thread + (i < remaining_rows ? 1 : 0);
+    band_rows(grid->rows, num_threads, i, &threadArgs[i].start_row,
+              &threadArgs[i].end_row);
     threadArgs[i].thread_num = i;
+    threadArgs[i].keep_stats = stats != NULL;
 
-    pthread_create(&threads[i], NULL, updateGridThread, (void *)&threadArgs[i]);
-
-    current_row = threadArgs[i].end_row;
+    pthread_attr_t attr;
+    pinned_attr(&attr, i);
+    pthread_create(&threads[i], &attr, updateGridThread, (void *)&threadArgs[i]);
+    pthread_attr_destroy(&attr);
   }
 
-    for (int i = 0; i < num_threads; i++) {
+  uint64_t hash = 0;
+  for (int i = 0; i < num_threads; i++) {
     pthread_join(threads[i], NULL);
+    hash += threadArgs[i].hash;
+    if (stats)
+      mergeStats(stats, &threadArgs[i].stats);
   }
+  return hash;
 }
 
 void swap(type **a, type **b) {
@@ -113,11 +860,135 @@ void swap(type **a, type **b) {
   *b = tmp;
 }
 
+// Combines the ranks' stats on rank 0. Each rank's columns start at
+// first_col; the maxima of the bounding box are reduced as negated minima.
+void reduceStats(Stats *stats, int first_col, int rank) {
+  if (stats->top <= stats->bottom) {
+    stats->left += first_col;
+    stats->right += first_col;
+  }
+  uint64_t counts[3] = {stats->population, stats->births, stats->deaths};
+  int box[4] = {stats->top, stats->left, -stats->bottom, -stats->right};
+  uint64_t total[3];
+  int extent[4];
+  MPI_Reduce(counts, total, 3, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(box, extent, 4, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    stats->population = total[0];
+    stats->births = total[1];
+    stats->deaths = total[2];
+    stats->top = extent[0];
+    stats->left = extent[1];
+    stats->bottom = -extent[2];
+    stats->right = -extent[3];
+  }
+}
+
+// one CSV line per generation, fully buffered
+FILE *openStats(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  setvbuf(file, NULL, _IOFBF, 1 << 20);
+  fprintf(file, "generation,population,births,deaths,top,left,bottom,right\n");
+  return file;
+}
+
+void writeStats(FILE *file, int generation, Stats *stats) {
+  const bool empty = stats->top > stats->bottom;
+  fprintf(file, "%d,%llu,%llu,%llu,%d,%d,%d,%d\n", generation,
+          (unsigned long long)stats->population,
+          (unsigned long long)stats->births,
+          (unsigned long long)stats->deaths, empty ? -1 : stats->top,
+          empty ? -1 : stats->left, empty ? -1 : stats->bottom,
+          empty ? -1 : stats->right);
+}
+
+// Run-time settings. The macros above are the defaults, overridden by
+// --rows/--cols/--steps/--scale/--threads/--seed/--density/--rule on the
+// command line or by "key value" or "key = value" lines in a --config file
+// ('#' comments).
+typedef struct {
+  int rows, cols, steps, scale, threads;
+  uint64_t seed;
+  double density;
+  const char *rule;
+} Config;
+
+Config config = {ROWS, COLS, MAX_STEPS, SCALE, THREADS, SEED, DENSITY, RULE};
+
+static bool set_option(Config *c, const char *key, const char *value) {
+  if (strcmp(key, "rule") == 0) {
+    c->rule = strdup(value);
+    return c->rule != NULL;
+  }
+  char *end;
+  errno = 0;
+  if (strcmp(key, "seed") == 0) {
+    c->seed = strtoull(value, &end, 0);
+    return end != value && !*end && !errno;
+  }
+  if (strcmp(key, "density") == 0) {
+    c->density = strtod(value, &end);
+    return end != value && !*end && c->density >= 0 && c->density <= 1;
+  }
+  int *field = strcmp(key, "rows") == 0    ? &c->rows
+               : strcmp(key, "cols") == 0  ? &c->cols
+               : strcmp(key, "steps") == 0 ? &c->steps
+               : strcmp(key, "scale") == 0 ? &c->scale
+                   : strcmp(key, "threads") == 0 ? &c->threads
+                                           : NULL;
+  long n = field ? strtol(value, &end, 10) : 0;
+  // --threads 0 is the default, one thread per core
+  if (!field || end == value || *end || errno || n < (field != &c->threads) ||
+      n > INT_MAX)
+    return false;
+  *field = (int)n;
+  return true;
+}
+
+bool loadConfig(const char *path, Config *c) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+  char line[256], key[64], value[192];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "#\n")] = '\0';
+    for (char *p = line; *p; p++)
+      if (*p == '=')
+        *p = ' ';
+    int fields = sscanf(line, "%63s %191s", key, value);
+    ok = fields <= 0 || (fields == 2 && set_option(c, key, value));
+  }
+  fclose(file);
+  return ok;
+}
+
+// --key value pairs, applied in order so later ones win
+bool parseArgs(int argc, char **argv, Config *c) {
+  for (int a = 1; a < argc; a += 2) {
+    const char *key = argv[a], *value = a + 1 < argc ? argv[a + 1] : NULL;
+    bool ok = value && strncmp(key, "--", 2) == 0 &&
+              (strcmp(key, "--config") == 0 ? loadConfig(value, c)
+                                            : set_option(c, key + 2, value));
+    if (!ok) {
+      fprintf(stderr, "Invalid option: %s %s\n", key, value ? value : "");
+      return false;
+    }
+  }
+  return true;
+}
+
 void draw2file_linear(type *grid, int step, unsigned char *data) {
-  for (int i = 0; i < ROWS * SCALE; ++i) {
-    for (int j = 0; j < COLS * SCALE; ++j) {
-      unsigned char value = grid[(i / SCALE) * COLS + (j / SCALE)] * 255;
-      int index = (i * COLS * SCALE + j) * 3;
+  const int scale = config.scale, width = config.cols * scale;
+  for (int i = 0; i < config.rows * scale; ++i) {
+    for (int j = 0; j < width; ++j) {
+      unsigned char value =
+          grid[(size_t)(i / scale) * config.cols + (j / scale)] * 255;
+      size_t index = ((size_t)i * width + j) * 3;
       data[index + 0] = value;
       data[index + 1] = value;
       data[index + 2] = value;
@@ -126,8 +997,7 @@ void draw2file_linear(type *grid, int step, unsigned char *data) {
 
   char filename[100];
   sprintf(filename, "out/%d.png", step);
-  stbi_write_png(filename, COLS * SCALE, ROWS * SCALE, 3, data,
-                 COLS * SCALE * 3);
+  stbi_write_png(filename, width, config.rows * scale, 3, data, width * 3);
 }
 
 // #define FFMPEG_PATH "out/ffmpeg.exe"
@@ -161,35 +1031,91 @@ int main(int argc, char **argv) {
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+  // every rank reads the same arguments, so they all agree on failure
+  bool valid = parseArgs(argc, argv, &config);
+  if (valid && !parseRule(config.rule, &rule)) {
+    if (rank == 0)
+      fprintf(stderr, "Invalid rule: %s\n", config.rule);
+    valid = false;
+  }
+  if (valid && config.cols % size) {
+    if (rank == 0)
+      fprintf(stderr, "cols (%d) must be a multiple of the %d ranks\n",
+              config.cols, size);
+    valid = false;
+  }
+  if (!valid) {
+    MPI_Finalize();
+    return 1;
+  }
+  const char *kernel = selectRowKernel();
+  if (rank == 0)
+    printf("Kernel: %s\n", kernel);
+
+  // Ranks on one node that were not bound to CPUs of their own all see the
+  // same mask, and split its cores in rank order instead of overlapping.
+  MPI_Comm node;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                      MPI_INFO_NULL, &node);
+  int node_rank, node_size;
+  MPI_Comm_rank(node, &node_rank);
+  MPI_Comm_size(node, &node_size);
+  cpu_set_t mask, all;
+  sched_getaffinity(0, sizeof(mask), &mask);
+  MPI_Allreduce(&mask, &all, sizeof(mask) / sizeof(unsigned long),
+                MPI_UNSIGNED_LONG, MPI_BOR, node);
+  MPI_Comm_free(&node);
+  const bool shared = CPU_EQUAL(&mask, &all);
+  const int cores = placeThreads(&mask, shared ? node_rank : 0,
+                                 shared ? node_size : 1);
+  if (!config.threads)
+    config.threads = cores;
+  printf("Rank %d: %d threads on %d CPUs\n", rank, config.threads, num_cpus);
+  if (config.threads > num_cpus)
+    printf("Rank %d: more threads than CPUs, they will take turns\n", rank);
+
   type *grid = NULL;
   type *out = NULL;
   unsigned char *data = NULL;
 
   if (rank == 0) {
-    srand(time(NULL));
-    grid = (type *)malloc(sizeof(type) * CELLS);
-    out = (type *)malloc(sizeof(type) * CELLS);
-    for (int i = 0; i < CELLS; i++)
-      grid[i] = rand() % 2;
+    const size_t cells = (size_t)config.rows * config.cols;
+    grid = (type *)malloc(sizeof(type) * cells);
+    out = (type *)malloc(sizeof(type) * cells);
+    randomCells(grid, 0, cells, config.seed, config.density);
 
-    const int size = ROWS * COLS * 3 * sizeof(unsigned char) * SCALE * SCALE;
+    const size_t size = (size_t)config.rows * config.cols * 3 *
+                        sizeof(unsigned char) * config.scale * config.scale;
     data = (unsigned char *)malloc(size);
   }
 
-  int cols_per_proc = COLS / size;
+  int cols_per_proc = config.cols / size;
 
   MPI_Datatype col;
   MPI_Datatype column;
-  MPI_Type_vector(ROWS, cols_per_proc, COLS, MPI_INT, &col);
+  MPI_Type_vector(config.rows, cols_per_proc, config.cols, MPI_CELL, &col);
   MPI_Type_commit(&col);
   MPI_Type_create_resized(col, 0, sizeof(type), &column);
   MPI_Type_commit(&column);
 
-  type *local_grid = (type *)malloc(sizeof(type) * ROWS * cols_per_proc);
-  type *local_updated = (type *)malloc(sizeof(type) * ROWS * cols_per_proc);
+  Grid local_grid = createGrid(config.rows, cols_per_proc, 0);
+  Grid local_updated = createGrid(config.rows, cols_per_proc, 0);
+  // each thread touches the band it updates, placing it on its NUMA node
+  touchGrid(&local_grid, config.threads, 1);
+  touchGrid(&local_updated, config.threads, 1);
+  if (rank == 0)
+    reportPlacement(&local_grid, config.threads, 1);
 
-  type *sendcounts = (type *)malloc(sizeof(type) * size);
-  type *displs = (type *)malloc(sizeof(type) * size);
+  // the interior of a padded local grid, skipping the ghost border
+  MPI_Datatype local;
+  MPI_Type_vector(config.rows, cols_per_proc, local_grid.stride, MPI_CELL, &local);
+  MPI_Type_commit(&local);
+  MPI_Datatype edge;
+  MPI_Type_vector(config.rows, 1, local_grid.stride, MPI_CELL, &edge);
+  MPI_Type_commit(&edge);
+
+  int *sendcounts = (int *)malloc(sizeof(int) * size);
+  int *displs = (int *)malloc(sizeof(int) * size);
 
   for (int i = 0; i < size; i++) {
     sendcounts[i] = 1;
@@ -201,16 +1127,26 @@ int main(int argc, char **argv) {
     draw2file_linear(grid, 0, data);
 #endif
 
-  for (int i = 0; i < MAX_STEPS && running; i++) {
+  History history = {{0}};
+#ifdef STATS
+  const bool keep_stats = true;
+#else
+  const bool keep_stats = false;
+#endif
+  FILE *stats_file = keep_stats && rank == 0 ? openStats(STATS_FILE) : NULL;
+  for (int i = 0; i < config.steps && running; i++) {
     printf("\n_________________ROUND %d_________________\n", i);
-    MPI_Scatterv(grid, sendcounts, displs, column, local_grid,
-                 ROWS * cols_per_proc, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Scatterv(grid, sendcounts, displs, column, local_grid.cells, 1, local,
+                 0, MPI_COMM_WORLD);
+    exchangeHalo(&local_grid, edge, rank, size);
 
-    // updateGrid(local_grid, ROWS, cols_per_proc, local_updated);
-    parallelUpdateGrid(grid, ROWS, cols_per_proc, local_updated, 30);
+    // updateGrid(&local_grid, &local_updated);
+    Stats stats = emptyStats();
+    uint64_t hash = parallelUpdateGrid(&local_grid, &local_updated, config.threads,
+                                       keep_stats ? &stats : NULL);
 
-    MPI_Gatherv(local_updated, ROWS * cols_per_proc, MPI_INT, out, sendcounts,
-                displs, column, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(local_updated.cells, 1, local, out, sendcounts, displs, column,
+                0, MPI_COMM_WORLD);
 
     if (rank == 0) {
       swap(&grid, &out);
@@ -219,17 +1155,38 @@ int main(int argc, char **argv) {
 #endif
     }
 
+    if (keep_stats) {
+      reduceStats(&stats, rank * cols_per_proc, rank);
+      if (stats_file)
+        writeStats(stats_file, i + 1, &stats);
+    }
+
+    // every rank hashes the same row numbers, so each mixes in its own
+    uint64_t mine = mix64(hash + rank), total = 0;
+    if (CYCLE_PERIOD)
+      MPI_Allreduce(&mine, &total, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    const int period = checkCycle(&history, total);
+    if (period) {
+      if (rank == 0)
+        printf("Period %d from generation %d\n", period, i + 1 - period);
+      break;
+    }
+
     MPI_Barrier(MPI_COMM_WORLD);
   }
 
   MPI_Type_free(&col);
   MPI_Type_free(&column);
+  MPI_Type_free(&local);
+  MPI_Type_free(&edge);
 
-  free(local_grid);
-  free(local_updated);
+  freeGrid(&local_grid);
+  freeGrid(&local_updated);
   free(sendcounts);
   free(displs);
 
+  if (stats_file)
+    fclose(stats_file);
   if (rank == 0) {
     free(grid);
     free(out);
@@ -1,144 +1,1997 @@
+#define _GNU_SOURCE // CPU affinity
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
 #include <pthread.h>
 
 bool running = true;
 void sigint_handler(int sig) { running = false; }
 
+// #define STATS // per-generation population, births, deaths and bounding box
+#ifndef STATS_FILE
+#define STATS_FILE "out/stats.csv"
+#endif
+// #define TORUS // edges wrap around instead of reading dead cells past them
+
 #define type bool
 #define ROWS 360
 #define COLS 640
 #define MAX_STEPS 200
 #define SCALE 2
+#define THREADS 0 // 0: one per core the process may run on (see placeThreads)
 
+// update kernels
+#define ENGINE_BYTES 0  // one byte per cell, SIMD when available
+#define ENGINE_ROWSUM 1 // separable sums over a 3-row rolling window
+#define ENGINE_TILES 2  // bytes, skipping tiles that did not change
+#define ENGINE_INPLACE 3 // bytes, one grid and two saved rows per thread
+
+#ifndef ENGINE
+#define ENGINE ENGINE_BYTES
+#endif
+
+// generation barriers of the worker pool
+#define BARRIER_PTHREAD 0 // pthread_barrier_t, straight to the kernel
+#define BARRIER_SPIN 1    // spins with pause for an adaptive while, then futex
+
+#ifndef BARRIER
+#define BARRIER BARRIER_SPIN
+#endif
+// bounds of the pauses BARRIER_SPIN spins for before sleeping
+#ifndef SPIN_MIN
+#define SPIN_MIN 64
+#endif
+#ifndef SPIN_MAX
+#define SPIN_MAX (1 << 16)
+#endif
+
+// where the threads run
+#define PIN_NONE 0    // wherever the scheduler puts them
+#define PIN_COMPACT 1 // thread k on the core after thread k - 1's
+#define PIN_SCATTER 2 // round robin over the sockets
+
+#ifndef PIN
+#define PIN PIN_COMPACT
+#endif
+// 1 counts and fills SMT siblings like cores; 0 puts one thread per core and
+// goes on to the siblings only when there are more threads than cores
+#ifndef SMT
+#define SMT 0
+#endif
+
+// how generations are handed to the threads
+#define SCHEDULE_BANDS 0     // a row band each, all meeting at every generation
+#define SCHEDULE_WAVEFRONT 1 // a row band each, waiting only on the neighbours
+#define SCHEDULE_STEALING 2  // tiles, idle threads stealing from busy ones
+
+#ifndef SCHEDULE
+#define SCHEDULE SCHEDULE_BANDS
+#endif
+#if SCHEDULE == SCHEDULE_WAVEFRONT && \
+    (ENGINE == ENGINE_TILES || ENGINE == ENGINE_INPLACE)
+#error "SCHEDULE_WAVEFRONT needs an engine writing a separate grid"
+#endif
+#if SCHEDULE == SCHEDULE_STEALING && ENGINE != ENGINE_TILES
+#error "SCHEDULE_STEALING hands out the tiles of ENGINE_TILES"
+#endif
+
+// rows are padded to a multiple of GRID_ALIGN bytes
+#ifndef GRID_ALIGN
+#define GRID_ALIGN 64
+#endif
+
+// One contiguous, GRID_ALIGN-aligned block with a one-cell ghost border that
+// reads as dead, or with TORUS holds the opposite edges (see wrapGrid). Cell (i, j) is at
+// cells[i * stride + j] for i in [-1, rows] and j in [-1, cols].
 typedef struct {
-  type **grid;
+  type *cells;
+  void *block;
   int rows;
   int cols;
-  type **out;
-  int start_row;
-  int end_row;
-  int thread_num;
-} ThreadArgs;
+  int stride;
+  size_t bytes; // mapped at block
+  size_t page;  // size of the pages behind it
+} Grid;
 
-void printGrid(type **grid, int rows, int cols) {
-  for (int i = 0; i < rows; i++)
-    for (int j = 0; j < cols; j++)
-      printf("%s", grid[i][j] ? "[*]" : "[ ]");
+// in 64 bits: rows * stride outgrows int long before it outgrows memory
+#define CELL(g, i, j) ((g)->cells[(int64_t)(i) * (g)->stride + (j)])
+
+void printGrid(Grid *grid) {
+  for (int i = 0; i < grid->rows; i++)
+    for (int j = 0; j < grid->cols; j++)
+      printf("%s", CELL(grid, i, j) ? "[*]" : "[ ]");
   printf("\n");
 
   printf("\n");
 }
 
-int count_neighbors(type **grid, int rows, int cols, int i, int j) {
-  int neighbors = 0;
-  for (int di = -1; di <= 1; di++)
-    for (int dj = -1; dj <= 1; dj++) {
-      int ni = i + di;
-      int nj = j + dj;
-      if (ni < 0 || ni >= rows || nj < 0 || nj >= cols)
-        continue;
-      neighbors += grid[ni][nj];
+// rulestring used unless --rule is given, e.g. B36/S23 (HighLife), B2/S (Seeds)
+#ifndef RULE
+#define RULE "B3/S23"
+#endif
+
+// A Life-like rule compiled from its rulestring. table[9 * alive + neighbors]
+// is the next state. The kernels look it up by the 3x3 sum s they compute,
+// cell included: born[s] for dead cells and kept[s] for live ones, padded to
+// 16 entries for byte shuffles, plus the list of sums that set each.
+typedef struct {
+  uint8_t table[18];
+  uint8_t born[16];
+  uint8_t kept[16];
+  uint8_t born_sums[9];
+  uint8_t kept_sums[9];
+  int born_count;
+  int kept_count;
+} Rule;
+
+Rule rule;
+
+// parses "B3/S23" style rulestrings (either part may come first or be empty)
+bool parseRule(const char *rulestring, Rule *out) {
+  Rule parsed = {{0}};
+  int part = 0;
+  for (const char *c = rulestring; *c; c++) {
+    if (*c == 'B' || *c == 'b')
+      part = 'B';
+    else if (*c == 'S' || *c == 's')
+      part = 'S';
+    else if (*c >= '0' && *c <= '8' && part)
+      parsed.table[(part == 'S') * 9 + *c - '0'] = 1;
+    else if (*c != '/')
+      return false;
+  }
+
+  for (int n = 0; n <= 8; n++) {
+    parsed.born[n] = parsed.table[n];
+    parsed.kept[n + 1] = parsed.table[9 + n];
+    if (parsed.table[n])
+      parsed.born_sums[parsed.born_count++] = n;
+    if (parsed.table[9 + n])
+      parsed.kept_sums[parsed.kept_count++] = n + 1;
+  }
+  *out = parsed;
+  return true;
+}
+
+// no bounds checks: the ghost border covers i - 1, i + 1, j - 1 and j + 1
+static inline int count_neighbors(const type *up, const type *row,
+                                  const type *down, int j) {
+  return up[j - 1] + up[j] + up[j + 1] + row[j - 1] + row[j] + row[j + 1] +
+         down[j - 1] + down[j] + down[j + 1];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+// One row of the rule on byte cells. The vertical sums of the columns left
+// of, at and right of each cell add up to its 3x3 block, self included, and
+// the next state is looked up from that sum: no branches, one byte a lane.
+// dst must not alias the input rows: a width that is not a multiple of the
+// vector width ends on one vector overlapping the previous one instead of a
+// cell-by-cell tail, which otherwise costs 2-10x per cell on odd widths.
+// When packed is not NULL the new cells also go there as bits, cell j at bit
+// j % 64 of packed[j / 64], taken from the vectors as they are stored, so
+// the row can be hashed (see hash_words) without reading it again.
+typedef void (*RowKernel)(const type *up, const type *row, const type *down,
+                          type *dst, int cols, uint64_t *packed);
+
+// cells [j, cols), word holding the packed cells [j & ~63, j) before them
+static void update_row_from(const type *up, const type *row,
+                            const type *down, type *dst, int j, int cols,
+                            uint64_t word, uint64_t *packed) {
+  for (; j < cols; j++) {
+    dst[j] = rule.table[count_neighbors(up, row, down, j) + 8 * row[j]];
+    word |= (uint64_t)dst[j] << (j & 63);
+    if (packed && (j & 63) == 63) {
+      packed[j >> 6] = word;
+      word = 0;
     }
-  return neighbors;
+  }
+  if (packed && (cols & 63))
+    packed[cols >> 6] = word;
+}
+
+static void update_row_scalar(const type *up, const type *row,
+                              const type *down, type *dst, int cols,
+                              uint64_t *packed) {
+  update_row_from(up, row, down, dst, 0, cols, 0, packed);
+}
+
+#ifdef X86_SIMD
+__attribute__((target("sse2"))) static inline __m128i
+column_sum_sse2(const type *up, const type *row, const type *down, int j) {
+  return _mm_add_epi8(
+      _mm_add_epi8(_mm_loadu_si128((const __m128i *)(up + j)),
+                   _mm_loadu_si128((const __m128i *)(row + j))),
+      _mm_loadu_si128((const __m128i *)(down + j)));
+}
+
+// SSE2 has no byte shuffle, so the sums of the rule are matched one by one.
+// Returns the new cells as a bit mask.
+__attribute__((target("sse2"))) static inline unsigned
+cells_sse2(const type *up, const type *row, const type *down, type *dst,
+           int j) {
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i sum = _mm_add_epi8(
+      _mm_add_epi8(column_sum_sse2(up, row, down, j - 1),
+                   column_sum_sse2(up, row, down, j)),
+      column_sum_sse2(up, row, down, j + 1));
+  __m128i alive =
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(row + j)), one);
+  __m128i born = _mm_setzero_si128(), kept = _mm_setzero_si128();
+  for (int k = 0; k < rule.born_count; k++)
+    born = _mm_or_si128(born,
+                        _mm_cmpeq_epi8(sum, _mm_set1_epi8(rule.born_sums[k])));
+  for (int k = 0; k < rule.kept_count; k++)
+    kept = _mm_or_si128(kept,
+                        _mm_cmpeq_epi8(sum, _mm_set1_epi8(rule.kept_sums[k])));
+  __m128i live = _mm_or_si128(_mm_andnot_si128(alive, born),
+                              _mm_and_si128(alive, kept));
+  _mm_storeu_si128((__m128i *)(dst + j), _mm_and_si128(live, one));
+  return _mm_movemask_epi8(live);
 }
 
-void updateGrid(type **grid, int rows, int cols, type **out) {
-  for (int i = 0; i < rows; i++)
-    for (int j = 0; j < cols; j++) {
-      int neighbors = count_neighbors(grid, rows, cols, i, j);
-      neighbors -= grid[i][j];
-      if (grid[i][j] && (neighbors < 2 || neighbors > 3))
-        out[i][j] = false;
-      else if (!grid[i][j] && neighbors == 3)
-        out[i][j] = true;
-      else
-        out[i][j] = grid[i][j];
+// The last, overlapping vector repeats cells below j; only its top cols - j
+// mask bits are new.
+__attribute__((target("sse2"))) static void
+update_row_sse2(const type *up, const type *row, const type *down, type *dst,
+                int cols, uint64_t *packed) {
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 16 <= cols; j += 16) {
+    word |= (uint64_t)cells_sse2(up, row, down, dst, j) << (j & 63);
+    if (packed && (j & 63) == 48) {
+      packed[j >> 6] = word;
+      word = 0;
     }
+  }
+  if (j < cols && cols >= 16) {
+    const unsigned mask = cells_sse2(up, row, down, dst, cols - 16);
+    word |= (uint64_t)(mask >> (16 - (cols - j))) << (j & 63);
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+column_sum_avx2(const type *up, const type *row, const type *down, int j) {
+  return _mm256_add_epi8(
+      _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(up + j)),
+                      _mm256_loadu_si256((const __m256i *)(row + j))),
+      _mm256_loadu_si256((const __m256i *)(down + j)));
+}
+
+// returns the new cells as a bit mask: their 1s shifted up to each sign bit
+__attribute__((target("avx2"))) static inline unsigned
+cells_avx2(const type *up, const type *row, const type *down, type *dst, int j,
+           __m256i born, __m256i kept) {
+  __m256i sum = _mm256_add_epi8(
+      _mm256_add_epi8(column_sum_avx2(up, row, down, j - 1),
+                      column_sum_avx2(up, row, down, j)),
+      column_sum_avx2(up, row, down, j + 1));
+  __m256i alive = _mm256_cmpeq_epi8(
+      _mm256_loadu_si256((const __m256i *)(row + j)), _mm256_set1_epi8(1));
+  __m256i next = _mm256_blendv_epi8(_mm256_shuffle_epi8(born, sum),
+                                    _mm256_shuffle_epi8(kept, sum), alive);
+  _mm256_storeu_si256((__m256i *)(dst + j), next);
+  return (unsigned)_mm256_movemask_epi8(_mm256_slli_epi16(next, 7));
+}
+
+__attribute__((target("avx2"))) static void
+update_row_avx2(const type *up, const type *row, const type *down, type *dst,
+                int cols, uint64_t *packed) {
+  const __m256i born = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)rule.born));
+  const __m256i kept = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)rule.kept));
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 32 <= cols; j += 32) {
+    const unsigned mask = cells_avx2(up, row, down, dst, j, born, kept);
+    word |= (uint64_t)mask << (j & 63);
+    if (packed && (j & 63) == 32) {
+      packed[j >> 6] = word;
+      word = 0;
+    }
+  }
+  if (j < cols && cols >= 32) {
+    const unsigned mask = cells_avx2(up, row, down, dst, cols - 32, born, kept);
+    word |= (uint64_t)(mask >> (32 - (cols - j))) << (j & 63);
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i
+column_sum_avx512(const type *up, const type *row, const type *down, int j) {
+  return _mm512_add_epi8(
+      _mm512_add_epi8(_mm512_loadu_si512(up + j), _mm512_loadu_si512(row + j)),
+      _mm512_loadu_si512(down + j));
+}
+
+// returns the new cells as a bit mask
+__attribute__((target("avx512f,avx512bw"))) static inline uint64_t
+cells_avx512(const type *up, const type *row, const type *down, type *dst,
+             int j, __m512i born, __m512i kept) {
+  __m512i sum = _mm512_add_epi8(
+      _mm512_add_epi8(column_sum_avx512(up, row, down, j - 1),
+                      column_sum_avx512(up, row, down, j)),
+      column_sum_avx512(up, row, down, j + 1));
+  __mmask64 alive = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row + j),
+                                           _mm512_set1_epi8(1));
+  __m512i next = _mm512_mask_blend_epi8(alive, _mm512_shuffle_epi8(born, sum),
+                                        _mm512_shuffle_epi8(kept, sum));
+  _mm512_storeu_si512(dst + j, next);
+  return _mm512_test_epi8_mask(next, next);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void
+update_row_avx512(const type *up, const type *row, const type *down,
+                  type *dst, int cols, uint64_t *packed) {
+  const __m512i born = _mm512_broadcast_i32x4(
+      _mm_loadu_si128((const __m128i *)rule.born));
+  const __m512i kept = _mm512_broadcast_i32x4(
+      _mm_loadu_si128((const __m128i *)rule.kept));
+  uint64_t word = 0;
+  int j = 0;
+  for (; j + 64 <= cols; j += 64) {
+    const uint64_t mask = cells_avx512(up, row, down, dst, j, born, kept);
+    if (packed)
+      packed[j >> 6] = mask;
+  }
+  if (j < cols && cols >= 64) {
+    word = cells_avx512(up, row, down, dst, cols - 64, born, kept) >>
+           (64 - (cols - j));
+    j = cols;
+  }
+  update_row_from(up, row, down, dst, j, cols, word, packed);
+}
+#endif
+
+RowKernel update_row = update_row_scalar;
+
+// picks the widest kernel this CPU supports, via CPUID
+const char *selectRowKernel() {
+#ifdef X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    update_row = update_row_avx512;
+    return "avx512";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    update_row = update_row_avx2;
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    update_row = update_row_sse2;
+    return "sse2";
+  }
+#endif
+  update_row = update_row_scalar;
+  return "scalar";
+}
+
+// Per-generation statistics, gathered while each row is still in cache right
+// after it is written. The bounding box is inclusive; top > bottom when
+// nothing is alive.
+typedef struct {
+  uint64_t population;
+  uint64_t births;
+  uint64_t deaths;
+  int top, left, bottom, right;
+} Stats;
+
+Stats emptyStats() {
+  Stats stats = {0, 0, 0, INT_MAX, INT_MAX, -1, -1};
+  return stats;
+}
+
+// adds row i, which went from prev to next, to stats
+static inline void row_stats(const type *prev, const type *next, int cols,
+                             int i, Stats *stats) {
+  const unsigned char *restrict a = (const unsigned char *)prev;
+  const unsigned char *restrict b = (const unsigned char *)next;
+  unsigned population = 0, births = 0, deaths = 0;
+  for (int j = 0; j < cols; j++) {
+    population += b[j];
+    births += b[j] & (a[j] ^ 1);
+    deaths += a[j] & (b[j] ^ 1);
+  }
+  stats->population += population;
+  stats->births += births;
+  stats->deaths += deaths;
+  if (population) {
+    int left = 0, right = cols - 1;
+    while (!b[left])
+      left++;
+    while (!b[right])
+      right--;
+    stats->top = i < stats->top ? i : stats->top;
+    stats->bottom = i;
+    stats->left = left < stats->left ? left : stats->left;
+    stats->right = right > stats->right ? right : stats->right;
+  }
+}
+
+// combines the partial stats of two disjoint parts of a generation
+void mergeStats(Stats *into, const Stats *part) {
+  into->population += part->population;
+  into->births += part->births;
+  into->deaths += part->deaths;
+  into->top = part->top < into->top ? part->top : into->top;
+  into->left = part->left < into->left ? part->left : into->left;
+  into->bottom = part->bottom > into->bottom ? part->bottom : into->bottom;
+  into->right = part->right > into->right ? part->right : into->right;
+}
+
+// Early stop: every generation is hashed while it is written, and one whose
+// hash matches the generation p steps back repeats with period p. Periods up
+// to CYCLE_PERIOD are found. The row kernels hand over the cells they store
+// already packed, so the byte engines hash without reading a row again; the
+// others pack a row while it is still in cache. -DCYCLE_PERIOD=0 turns it off.
+#ifndef CYCLE_PERIOD
+#define CYCLE_PERIOD 8
+#endif
+
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t h) {
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+// Hash of row i as n words. A generation hashes to the sum over its rows, so
+// threads and ranks add up their own rows in any order. Tiles hash their part
+// of each row under an index of its own instead (see tile_hash).
+static inline uint64_t hash_words(const uint64_t *words, int n, int64_t i) {
+  uint64_t h = mix64(i + 1);
+  for (int w = 0; w < n; w++)
+    h = (h ^ words[w]) * 0x9e3779b97f4a7c15ULL;
+  return mix64(h);
+}
+
+// the same for a row of 0 or 1 byte cells, packed 64 to a word first as the
+// row kernels pack them: one multiply gathers 8 cells into a byte
+static inline uint64_t hash_row(const type *row, int cols, int64_t i) {
+  uint64_t h = mix64(i + 1);
+  for (int j = 0; j < cols; j += 64) {
+    uint64_t word = 0;
+    int k = 0;
+    for (; k < 64 && j + k + 8 <= cols; k += 8) {
+      uint64_t bytes;
+      memcpy(&bytes, row + j + k, sizeof(bytes));
+      word |= (bytes * 0x0102040810204080ULL >> 56) << k;
+    }
+    for (; k < 64 && j + k < cols; k++)
+      word |= (uint64_t)row[j + k] << k;
+    h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+  }
+  return mix64(h);
+}
+
+// a ring of the last generation hashes
+typedef struct {
+  uint64_t hashes[CYCLE_PERIOD + 1];
+  long count;
+} History;
+
+// records a generation's hash and returns its period, or 0 if it is new
+int checkCycle(History *history, uint64_t hash) {
+  int period = 0;
+  for (int p = 1; p <= CYCLE_PERIOD && p <= history->count && !period; p++)
+    if (history->hashes[(history->count - p) % (CYCLE_PERIOD + 1)] == hash)
+      period = p;
+  history->hashes[history->count++ % (CYCLE_PERIOD + 1)] = hash;
+  return period;
+}
+
+// returns the hash of the rows written, and adds them to stats unless NULL
+uint64_t updateRows(Grid *grid, Grid *out, int start_row, int end_row,
+                    Stats *stats) {
+  uint64_t hash = 0;
+#if CYCLE_PERIOD
+  const int words = (grid->cols + 63) / 64;
+  uint64_t *packed = (uint64_t *)malloc(words * sizeof(uint64_t));
+#else
+  uint64_t *packed = NULL;
+#endif
+  for (int i = start_row; i < end_row; i++) {
+    update_row(&CELL(grid, i - 1, 0), &CELL(grid, i, 0), &CELL(grid, i + 1, 0),
+               &CELL(out, i, 0), grid->cols, packed);
+#if CYCLE_PERIOD
+    hash += hash_words(packed, words, i);
+#endif
+    if (stats)
+      row_stats(&CELL(grid, i, 0), &CELL(out, i, 0), grid->cols, i, stats);
+  }
+  free(packed);
+  return hash;
+}
+
+uint64_t updateGrid(Grid *grid, Grid *out, Stats *stats) {
+  return updateRows(grid, out, 0, grid->rows, stats);
+}
+
+// In place: rows [start, end) advance one generation without a second grid.
+// Each row is saved with its border before it is overwritten, so the row
+// below still reads the old one; two saved rows are all the memory used.
+// above and below are rows start - 1 and end as they were, and must be
+// copies when another band overwrites them.
+uint64_t updateRowsInPlace(Grid *grid, int start, int end, const type *above,
+                           const type *below, Stats *stats) {
+  const int cols = grid->cols;
+  const size_t width = (cols + 2) * sizeof(type);
+  uint64_t hash = 0;
+#if CYCLE_PERIOD
+  const int words = (cols + 63) / 64;
+  uint64_t *packed = (uint64_t *)malloc(words * sizeof(uint64_t));
+#else
+  uint64_t *packed = NULL;
+#endif
+  type *ring = (type *)malloc(2 * width);
+  type *up = ring + 1;
+  type *row = ring + cols + 3;
+
+  memcpy(up - 1, above - 1, width);
+  for (int i = start; i < end; i++) {
+    type *cells = &CELL(grid, i, 0);
+    memcpy(row - 1, cells - 1, width);
+    update_row(up, row, i + 1 < end ? &CELL(grid, i + 1, 0) : below, cells,
+               cols, packed);
+#if CYCLE_PERIOD
+    hash += hash_words(packed, words, i);
+#endif
+    if (stats)
+      row_stats(row, cells, cols, i, stats);
+
+    type *tmp = up;
+    up = row;
+    row = tmp;
+  }
+
+  free(ring);
+  free(packed);
+  return hash;
+}
+
+// the border rows are never written, so they need no copies
+uint64_t updateGridInPlace(Grid *grid, Stats *stats) {
+  return updateRowsInPlace(grid, 0, grid->rows, &CELL(grid, -1, 0),
+                           &CELL(grid, grid->rows, 0), stats);
+}
+
+// Separable neighbor count: the horizontal 3-cell sums of each input row are
+// computed once and kept in a ring of three rows, so every output cell adds
+// three partial sums instead of loading its 9 cells again. Cells are read as
+// bytes, which keeps GCC's vectorizer away from bool conversions.
+static void row_sums(const unsigned char *restrict row,
+                     unsigned char *restrict sums, int cols) {
+  for (int j = 0; j < cols; j++)
+    sums[j] = row[j - 1] + row[j] + row[j + 1];
+}
+
+static void add_row_sums(const unsigned char *restrict up,
+                         const unsigned char *restrict mid,
+                         const unsigned char *restrict down,
+                         const unsigned char *restrict row,
+                         unsigned char *restrict sum,
+                         unsigned char *restrict dst, int cols) {
+  for (int j = 0; j < cols; j++) {
+    sum[j] = up[j] + mid[j] + down[j];
+    dst[j] = 0;
+  }
+  // one pass per sum the rule uses, so that every loop vectorizes
+  for (int k = 0; k < rule.born_count; k++) {
+    const unsigned char born = rule.born_sums[k];
+    for (int j = 0; j < cols; j++)
+      dst[j] |= (sum[j] == born) & (row[j] ^ 1);
+  }
+  for (int k = 0; k < rule.kept_count; k++) {
+    const unsigned char kept = rule.kept_sums[k];
+    for (int j = 0; j < cols; j++)
+      dst[j] |= (sum[j] == kept) & row[j];
+  }
+}
+
+uint64_t updateRowsRowSum(Grid *grid, Grid *out, int start_row, int end_row,
+                          Stats *stats) {
+  const int cols = grid->cols;
+  uint64_t hash = 0;
+  unsigned char *ring = (unsigned char *)malloc(4 * (size_t)cols);
+  unsigned char *up = ring;
+  unsigned char *mid = ring + cols;
+  unsigned char *down = ring + 2 * cols;
+  unsigned char *sum = ring + 3 * cols;
+
+  row_sums((unsigned char *)&CELL(grid, start_row - 1, 0), up, cols);
+  row_sums((unsigned char *)&CELL(grid, start_row, 0), mid, cols);
+  for (int i = start_row; i < end_row; i++) {
+    row_sums((unsigned char *)&CELL(grid, i + 1, 0), down, cols);
+    add_row_sums(up, mid, down, (unsigned char *)&CELL(grid, i, 0), sum,
+                 (unsigned char *)&CELL(out, i, 0), cols);
+#if CYCLE_PERIOD
+    hash += hash_row(&CELL(out, i, 0), cols, i);
+#endif
+    if (stats)
+      row_stats(&CELL(grid, i, 0), &CELL(out, i, 0), cols, i, stats);
+
+    unsigned char *tmp = up;
+    up = mid;
+    mid = down;
+    down = tmp;
+  }
+
+  free(ring);
+  return hash;
+}
+
+uint64_t updateGridRowSum(Grid *grid, Grid *out, Stats *stats) {
+  return updateRowsRowSum(grid, out, 0, grid->rows, stats);
+}
+
+// Active tiles: the grid is cut into TILE x TILE tiles with one flag per tile
+// for "changed last generation". A tile whose 3x3 tile neighborhood did not
+// change computes to what it already is, and since out holds the previous
+// generation it also holds that tile already, so it is skipped.
+#ifndef TILE
+#define TILE 64
+#endif
+
+typedef struct {
+  int rows; // tiles per column
+  int cols; // tiles per row
+  bool *changed;
+  bool *next;
+  uint64_t *hashes; // per tile, of its cells in the newest generation
+  Stats *records;   // with STATS, per tile: its population and bounding box
+} Tiles;
+
+// adds cells [j0, j0 + width) of row i, which went from grid to out, to stats
+static void segment_stats(Grid *grid, Grid *out, int i, int j0, int width,
+                          Stats *stats) {
+  Stats part = emptyStats();
+  row_stats(&CELL(grid, i, j0), &CELL(out, i, j0), width, i, &part);
+  if (part.population) {
+    part.left += j0;
+    part.right += j0;
+  }
+  mergeStats(stats, &part);
+}
+
+#if CYCLE_PERIOD
+// Tile (ti, tj) of grid, its part of row i hashed as row
+// i * tiles->cols + tj
+static uint64_t tile_hash(Grid *grid, Tiles *tiles, int ti, int tj) {
+  const int i0 = ti * TILE, j0 = tj * TILE;
+  const int i1 = i0 + TILE < grid->rows ? i0 + TILE : grid->rows;
+  const int width = (j0 + TILE < grid->cols ? j0 + TILE : grid->cols) - j0;
+  uint64_t hash = 0;
+  for (int i = i0; i < i1; i++)
+    hash += hash_row(&CELL(grid, i, j0), width, (int64_t)i * tiles->cols + tj);
+  return hash;
+}
+#endif
+
+// flags every tile as changed, and hashes and counts the tiles of grid
+Tiles createTiles(Grid *grid) {
+  Tiles tiles;
+  tiles.rows = (grid->rows + TILE - 1) / TILE;
+  tiles.cols = (grid->cols + TILE - 1) / TILE;
+  tiles.changed = (bool *)malloc((size_t)tiles.rows * tiles.cols);
+  tiles.next = (bool *)malloc((size_t)tiles.rows * tiles.cols);
+  tiles.hashes = NULL;
+  tiles.records = NULL;
+  for (size_t t = 0; t < (size_t)tiles.rows * tiles.cols; t++)
+    tiles.changed[t] = true;
+#if CYCLE_PERIOD
+  tiles.hashes =
+      (uint64_t *)malloc((size_t)tiles.rows * tiles.cols * sizeof(uint64_t));
+  for (int ti = 0; ti < tiles.rows; ti++)
+    for (int tj = 0; tj < tiles.cols; tj++)
+      tiles.hashes[(size_t)ti * tiles.cols + tj] =
+          tile_hash(grid, &tiles, ti, tj);
+#endif
+#ifdef STATS
+  tiles.records =
+      (Stats *)malloc((size_t)tiles.rows * tiles.cols * sizeof(Stats));
+  for (int ti = 0; ti < tiles.rows; ti++)
+    for (int tj = 0; tj < tiles.cols; tj++) {
+      Stats *record = &tiles.records[(size_t)ti * tiles.cols + tj];
+      const int i0 = ti * TILE, j0 = tj * TILE;
+      const int i1 = i0 + TILE < grid->rows ? i0 + TILE : grid->rows;
+      const int width = (j0 + TILE < grid->cols ? j0 + TILE : grid->cols) - j0;
+      *record = emptyStats();
+      for (int i = i0; i < i1; i++)
+        segment_stats(grid, grid, i, j0, width, record);
+    }
+#endif
+  return tiles;
+}
+
+void freeTiles(Tiles *tiles) {
+  free(tiles->changed);
+  free(tiles->next);
+  free(tiles->hashes);
+  free(tiles->records);
+}
+
+static bool tile_active(Tiles *tiles, int ti, int tj) {
+  for (int i = ti - 1; i <= ti + 1; i++)
+    for (int j = tj - 1; j <= tj + 1; j++) {
+#ifdef TORUS
+      const int wi = (i + tiles->rows) % tiles->rows;
+      const int wj = (j + tiles->cols) % tiles->cols;
+      if (tiles->changed[(size_t)wi * tiles->cols + wj])
+        return true;
+#else
+      if (i >= 0 && i < tiles->rows && j >= 0 && j < tiles->cols &&
+          tiles->changed[(size_t)i * tiles->cols + j])
+        return true;
+#endif
+    }
+  return false;
+}
+
+// The tile rows [start, end), writing their flags to tiles->next. Each cell
+// row is updated in one call per run of active tiles, and a tile stops
+// comparing old and new cells once it is known to have changed. Only the
+// tiles that changed are hashed again, and only the cells written are
+// counted; the other tiles hold what they did, and add their records.
+uint64_t updateTileRows(Grid *grid, Grid *out, Tiles *tiles, int start,
+                        int end, Stats *stats) {
+  bool *active = (bool *)malloc(tiles->cols);
+  Stats *parts = stats ? (Stats *)malloc(tiles->cols * sizeof(Stats)) : NULL;
+  uint64_t hash = 0;
+  for (int ti = start; ti < end; ti++) {
+    bool *next = &tiles->next[(size_t)ti * tiles->cols];
+    for (int tj = 0; tj < tiles->cols; tj++) {
+      active[tj] = tile_active(tiles, ti, tj);
+      next[tj] = false;
+      if (parts)
+        parts[tj] = emptyStats();
+    }
+
+    const int i1 = (ti + 1) * TILE < grid->rows ? (ti + 1) * TILE : grid->rows;
+    for (int i = ti * TILE; i < i1; i++) {
+      for (int tj = 0; tj < tiles->cols;) {
+        if (!active[tj]) {
+          tj++;
+          continue;
+        }
+        int run = tj;
+        while (tj < tiles->cols && active[tj])
+          tj++;
+
+        const int j0 = run * TILE;
+        const int j1 = tj * TILE < grid->cols ? tj * TILE : grid->cols;
+        update_row(&CELL(grid, i - 1, j0), &CELL(grid, i, j0),
+                   &CELL(grid, i + 1, j0), &CELL(out, i, j0), j1 - j0,
+                   NULL);
+        for (int t = run; t < tj; t++) {
+          const int width = t + 1 < tj ? TILE : j1 - t * TILE;
+          next[t] = next[t] || memcmp(&CELL(grid, i, t * TILE),
+                                      &CELL(out, i, t * TILE),
+                                      width * sizeof(type)) != 0;
+          if (parts)
+            segment_stats(grid, out, i, t * TILE, width, &parts[t]);
+        }
+      }
+    }
+    if (stats) {
+      Stats *records = &tiles->records[(size_t)ti * tiles->cols];
+      for (int tj = 0; tj < tiles->cols; tj++) {
+        if (active[tj]) {
+          records[tj] = parts[tj];
+          records[tj].births = records[tj].deaths = 0;
+        }
+        mergeStats(stats, active[tj] ? &parts[tj] : &records[tj]);
+      }
+    }
+#if CYCLE_PERIOD
+    uint64_t *hashes = &tiles->hashes[(size_t)ti * tiles->cols];
+    for (int tj = 0; tj < tiles->cols; tj++) {
+      if (next[tj])
+        hashes[tj] = tile_hash(out, tiles, ti, tj);
+      hash += hashes[tj];
+    }
+#endif
+  }
+  free(active);
+  free(parts);
+  return hash;
+}
+
+// Tile (ti, tj) alone, for SCHEDULE_STEALING, writing its flag to
+// tiles->next. An inactive tile reads no cells: it adds the hash and the
+// record it already has.
+uint64_t updateTile(Grid *grid, Grid *out, Tiles *tiles, int ti, int tj,
+                    Stats *stats) {
+  const int i0 = ti * TILE, j0 = tj * TILE;
+  const int i1 = i0 + TILE < grid->rows ? i0 + TILE : grid->rows;
+  const int width = (j0 + TILE < grid->cols ? j0 + TILE : grid->cols) - j0;
+  const bool active = tile_active(tiles, ti, tj);
+  const size_t t = (size_t)ti * tiles->cols + tj;
+  bool changed = false;
+  Stats part = emptyStats();
+  for (int i = i0; active && i < i1; i++) {
+    update_row(&CELL(grid, i - 1, j0), &CELL(grid, i, j0),
+               &CELL(grid, i + 1, j0), &CELL(out, i, j0), width, NULL);
+    changed = changed || memcmp(&CELL(grid, i, j0), &CELL(out, i, j0),
+                                width * sizeof(type)) != 0;
+    if (stats)
+      segment_stats(grid, out, i, j0, width, &part);
+  }
+  if (stats) {
+    if (active) {
+      tiles->records[t] = part;
+      tiles->records[t].births = tiles->records[t].deaths = 0;
+    }
+    mergeStats(stats, active ? &part : &tiles->records[t]);
+  }
+  tiles->next[t] = changed;
+#if CYCLE_PERIOD
+  if (changed)
+    tiles->hashes[t] = tile_hash(out, tiles, ti, tj);
+  return tiles->hashes[t];
+#else
+  return 0;
+#endif
+}
+
+// makes the flags just written the "changed last generation" ones
+void swapTiles(Tiles *tiles) {
+  bool *tmp = tiles->changed;
+  tiles->changed = tiles->next;
+  tiles->next = tmp;
+}
+
+uint64_t updateGridTiles(Grid *grid, Grid *out, Tiles *tiles, Stats *stats) {
+  uint64_t hash = updateTileRows(grid, out, tiles, 0, tiles->rows, stats);
+  swapTiles(tiles);
+  return hash;
+}
+
+static inline int64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static inline void cpu_pause() {
+#ifdef X86_SIMD
+  _mm_pause();
+#endif
+}
+
+static long futex(atomic_int *word, int op, int value) {
+  return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
+
+// One CPU of the affinity mask, and where it sits: sockets and cores are
+// numbered in the order found, siblings within their core.
+typedef struct {
+  int cpu;
+  int package;
+  int core;    // across all packages
+  int in_core; // SMT sibling number
+  int in_package;
+  int core_id; // as the kernel reports it
+} Slot;
+
+// the CPUs threads are pinned to, thread k on cpus[k % num_cpus]
+int *cpus = NULL;
+int num_cpus = 0;
+
+static int read_topology(int cpu, const char *what) {
+  char path[96];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+           cpu, what);
+  FILE *file = fopen(path, "r");
+  int value = -1;
+  if (file) {
+    if (fscanf(file, "%d", &value) != 1)
+      value = -1;
+    fclose(file);
+  }
+  return value;
+}
+
+static int by_topology(const void *a, const void *b) {
+  const Slot *x = (const Slot *)a, *y = (const Slot *)b;
+  if (x->package != y->package)
+    return x->package - y->package;
+  if (x->core_id != y->core_id)
+    return x->core_id - y->core_id;
+  return x->cpu - y->cpu;
+}
+
+static int by_policy(const void *a, const void *b) {
+  const Slot *x = (const Slot *)a, *y = (const Slot *)b;
+  const int first[] = {SMT ? 0 : x->in_core - y->in_core,
+                       PIN == PIN_SCATTER ? x->in_core - y->in_core : 0,
+                       PIN == PIN_SCATTER ? x->in_package - y->in_package
+                                          : x->core - y->core,
+                       PIN == PIN_SCATTER ? x->package - y->package
+                                          : x->in_core - y->in_core};
+  for (int k = 0; k < 4; k++)
+    if (first[k])
+      return first[k];
+  return 0;
+}
+
+// Lays the threads out on the CPUs of mask, keeping the cores of part
+// [part, part + 1) of parts when processes share the mask, and returns how
+// many threads that calls for: its cores, or with SMT its CPUs. cpus lists
+// them in pinning order, siblings last unless SMT, so that extra threads go
+// to idle siblings before doubling up on a CPU.
+int placeThreads(const cpu_set_t *mask, int part, int parts) {
+  Slot *slots = (Slot *)malloc(CPU_COUNT(mask) * sizeof(Slot));
+  int n = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, mask)) {
+      slots[n].cpu = cpu;
+      slots[n].package = read_topology(cpu, "physical_package_id");
+      slots[n].core_id = read_topology(cpu, "core_id");
+      // without sysfs every CPU is a core of its own
+      if (slots[n].package < 0 || slots[n].core_id < 0) {
+        slots[n].package = 0;
+        slots[n].core_id = cpu;
+      }
+      n++;
+    }
+  qsort(slots, n, sizeof(Slot), by_topology);
+
+  int cores = 0, packages = 0;
+  for (int k = 0; k < n; k++) {
+    const bool new_package = k == 0 || slots[k].package != slots[k - 1].package;
+    const bool new_core = new_package || slots[k].core_id != slots[k - 1].core_id;
+    packages += new_package;
+    cores += new_core;
+    slots[k].core = cores - 1;
+    slots[k].in_core = new_core ? 0 : slots[k - 1].in_core + 1;
+    slots[k].in_package =
+        new_package ? 0 : slots[k - 1].in_package + new_core;
+  }
+
+  // this part's cores, which are consecutive in slots; with more parts than
+  // cores, the one core it would share
+  const int first = part * cores / parts;
+  int last = (part + 1) * cores / parts;
+  if (last == first && first < cores)
+    last = first + 1;
+  int kept = 0;
+  for (int k = 0; k < n; k++)
+    if (slots[k].core >= first && slots[k].core < last)
+      slots[kept++] = slots[k];
+  qsort(slots, kept, sizeof(Slot), by_policy);
+
+  free(cpus);
+  cpus = (int *)malloc(kept * sizeof(int));
+  num_cpus = kept;
+  for (int k = 0; k < kept; k++)
+    cpus[k] = slots[k].cpu;
+  free(slots);
+  return SMT ? kept : last - first;
+}
+
+// attributes pinning a new thread k to its CPU
+static void pinned_attr(pthread_attr_t *attr, int k) {
+  pthread_attr_init(attr);
+  if (PIN != PIN_NONE && num_cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[k % num_cpus], &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+  }
+}
+
+#if BARRIER == BARRIER_PTHREAD
+typedef pthread_barrier_t Barrier;
+
+void initBarrier(Barrier *barrier, int count) {
+  pthread_barrier_init(barrier, NULL, count);
+}
+// true in exactly one of the threads
+bool waitBarrier(Barrier *barrier) {
+  return pthread_barrier_wait(barrier) == PTHREAD_BARRIER_SERIAL_THREAD;
+}
+void freeBarrier(Barrier *barrier) { pthread_barrier_destroy(barrier); }
+#else
+// A sense-reversing barrier. The last of count threads to arrive resets the
+// count and flips sense; the others wait for sense to move off the value they
+// arrived on, spinning for up to spin pauses and then sleeping on it as a
+// futex. spin doubles whenever a wait ends while spinning and halves whenever
+// it ends asleep, so it follows how long the threads take to line up and
+// stops burning cores when they are oversubscribed.
+typedef struct {
+  int count;
+  atomic_int waiting;  // threads arrived this round
+  atomic_int sense;    // flips once a round, also the futex word
+  atomic_int sleepers; // threads asleep on sense
+  atomic_int spin;     // pauses before sleeping
+} Barrier;
+
+void initBarrier(Barrier *barrier, int count) {
+  barrier->count = count;
+  atomic_init(&barrier->waiting, 0);
+  atomic_init(&barrier->sense, 0);
+  atomic_init(&barrier->sleepers, 0);
+  atomic_init(&barrier->spin, SPIN_MIN);
+}
+
+// true in exactly one of the threads, the last to arrive
+bool waitBarrier(Barrier *barrier) {
+  // cannot flip before this thread arrives, so it is this round's
+  const int sense = atomic_load_explicit(&barrier->sense, memory_order_acquire);
+  if (atomic_fetch_add_explicit(&barrier->waiting, 1, memory_order_acq_rel) ==
+      barrier->count - 1) {
+    atomic_store_explicit(&barrier->waiting, 0, memory_order_relaxed);
+    atomic_store(&barrier->sense, !sense);
+    if (atomic_load(&barrier->sleepers))
+      futex(&barrier->sense, FUTEX_WAKE_PRIVATE, INT_MAX);
+    return true;
+  }
+
+  const int spin = atomic_load_explicit(&barrier->spin, memory_order_relaxed);
+  for (int k = 0; k < spin; k++) {
+    if (atomic_load_explicit(&barrier->sense, memory_order_acquire) != sense) {
+      if (spin < SPIN_MAX)
+        atomic_store_explicit(&barrier->spin, 2 * spin, memory_order_relaxed);
+      return false;
+    }
+    cpu_pause();
+  }
+  if (spin > SPIN_MIN)
+    atomic_store_explicit(&barrier->spin, spin / 2, memory_order_relaxed);
+
+  atomic_fetch_add(&barrier->sleepers, 1);
+  while (atomic_load(&barrier->sense) == sense)
+    futex(&barrier->sense, FUTEX_WAIT_PRIVATE, sense);
+  atomic_fetch_sub(&barrier->sleepers, 1);
+  return false;
+}
+void freeBarrier(Barrier *barrier) {
+  (void)barrier; // plain atomics, nothing to free
+}
+#endif
+
+// A Chase-Lev deque of tile numbers. Its owner pushes and pops at the bottom
+// without contention; other threads steal from the top, and a compare and
+// swap on top settles the race for the last task. The ring never grows: it
+// is sized for every task a thread can be handed in a generation.
+#define TASK_EMPTY -1
+#define TASK_ABORT -2 // lost a race, worth trying again
+
+typedef struct {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  atomic_long *tasks;
+  long mask; // ring size - 1, a power of two
+} Deque;
+
+void initDeque(Deque *deque, long capacity) {
+  long size = 1;
+  while (size < capacity)
+    size *= 2;
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+  deque->tasks = (atomic_long *)malloc(size * sizeof(atomic_long));
+  deque->mask = size - 1;
+}
+
+void freeDeque(Deque *deque) { free(deque->tasks); }
+
+// owner only
+void pushTask(Deque *deque, long task) {
+  const long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  atomic_store_explicit(&deque->tasks[b & deque->mask], task,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+}
+
+// owner only, the task pushed last
+long popTask(Deque *deque) {
+  const long b =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  long task = TASK_EMPTY;
+  if (t <= b) {
+    task = atomic_load_explicit(&deque->tasks[b & deque->mask],
+                                memory_order_relaxed);
+    if (t < b)
+      return task;
+    // the last one: thieves may be after it too
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+      task = TASK_EMPTY;
+  }
+  atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+  return task;
+}
+
+// any thread, the task pushed first
+long stealTask(Deque *deque) {
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  const long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (t >= b)
+    return TASK_EMPTY;
+  const long task = atomic_load_explicit(&deque->tasks[t & deque->mask],
+                                         memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return TASK_ABORT;
+  return task;
+}
+
+// What a generation spends synchronizing, in microseconds: from the caller
+// releasing the workers to the last of them starting, and from the last of
+// them finishing to the caller resuming. Measured when stats are kept. The
+// wavefront stores the longest a band waited on its neighbours and how long
+// the caller waited for the last band instead, under their own column names.
+typedef struct {
+  double start, done;
+} Latency;
+
+typedef struct Pool Pool;
+
+typedef struct {
+  Pool *pool;
+  Grid *grid;
+  Grid *out;
+  Tiles *tiles; // NULL unless ENGINE_TILES, rows below are then tile rows
+  int start_row; // SCHEDULE_STEALING: the tiles, counted row by row, that
+  int end_row;   // the thread is handed before any stealing
+  int thread_num;
+  const type *above, *below; // ENGINE_INPLACE: the rows around the band
+  uint64_t hash; // of the rows written
+  Stats stats;   // of the rows written, when stats are kept
+  bool keep_stats;
+  int64_t started, finished; // the band, in ns, when stats are kept
+  int64_t busy; // ns spent updating, over the whole run
+  long steals;  // tiles taken from other threads, likewise
+  uint64_t victim; // SCHEDULE_STEALING: state of the victim picks
+  int spin;        // SCHEDULE_STEALING: failed picks before sleeping
+} ThreadArgs;
+
+// Threads created once and reused by every generation. The caller meets them
+// at start once their bands are set and again at done once every band is
+// written; in between generations it is the only thread running, so swapping
+// the grids, drawing and the stats need no locks.
+struct Pool {
+  pthread_t *threads;
+  ThreadArgs *args;
+  int num_threads;
+  Barrier start, done; // num_threads workers plus the caller
+  bool quit;
+  type *edges; // ENGINE_INPLACE: the rows around each band
+  Latency latency; // of the last generation
+  Deque *deques;   // SCHEDULE_STEALING: one per thread
+  atomic_int remaining; // SCHEDULE_STEALING: tiles not done this generation,
+  atomic_int sleepers;  // and the threads asleep on it
+};
+
+// sleeps until every tile of the generation is done
+static void wait_remaining(Pool *pool) {
+  atomic_fetch_add(&pool->sleepers, 1);
+  int left;
+  while ((left = atomic_load(&pool->remaining)) > 0)
+    futex(&pool->remaining, FUTEX_WAIT_PRIVATE, left);
+  atomic_fetch_sub(&pool->sleepers, 1);
+}
+
+// Each thread pushes the tiles it is handed, pops them back in order and,
+// once out of them, steals from the top of random other deques until every
+// tile of the generation is done. A thief that fails spin times in a row
+// sleeps on remaining until the thread finishing the last tile wakes it, and
+// spin adapts as in waitBarrier, so idle thieves leave the CPU to the
+// threads still updating when there are more threads than cores.
+static uint64_t steal_tiles(ThreadArgs *args, Stats *stats) {
+  Pool *pool = args->pool;
+  Tiles *tiles = args->tiles;
+  Deque *own = &pool->deques[args->thread_num];
+  for (long task = args->end_row - 1; task >= args->start_row; task--)
+    pushTask(own, task);
+
+  uint64_t hash = 0;
+  int failed = 0;
+  while (atomic_load_explicit(&pool->remaining, memory_order_acquire) > 0) {
+    long task = popTask(own);
+    if (task < 0 && pool->num_threads > 1) {
+      args->victim = mix64(args->victim);
+      int victim = args->victim % (pool->num_threads - 1);
+      victim += victim >= args->thread_num;
+      task = stealTask(&pool->deques[victim]);
+      args->steals += task >= 0;
+    }
+    if (task < 0) {
+      if (++failed < args->spin) {
+        cpu_pause();
+        continue;
+      }
+      if (args->spin > SPIN_MIN)
+        args->spin /= 2;
+      failed = 0;
+      wait_remaining(pool);
+      continue;
+    }
+    if (failed && args->spin < SPIN_MAX)
+      args->spin *= 2;
+    failed = 0;
+
+    const int64_t begun = now_ns();
+    hash += updateTile(args->grid, args->out, tiles, task / tiles->cols,
+                       task % tiles->cols, stats);
+    args->busy += now_ns() - begun;
+    if (atomic_fetch_sub(&pool->remaining, 1) == 1 &&
+        atomic_load(&pool->sleepers))
+      futex(&pool->remaining, FUTEX_WAKE_PRIVATE, INT_MAX);
+  }
+  // the generation ended while spinning
+  if (failed && args->spin < SPIN_MAX)
+    args->spin *= 2;
+  return hash;
 }
 
 // Thread function
 void *updateGridThread(void *arguments) {
   ThreadArgs *args = (ThreadArgs *)arguments;
+  Pool *pool = args->pool;
   printf("I'm the Thread N.%d\n", args->thread_num);
 
-  for (int i = args->start_row; i < args->end_row; i++) {
-    for (int j = 0; j < args->cols; j++) {
-      int neighbors = count_neighbors(args->grid, args->rows, args->cols, i, j);
-      neighbors -= args->grid[i][j];
+  for (;;) {
+    waitBarrier(&pool->start);
+    if (pool->quit)
+      break;
+    const int64_t started = now_ns();
+    if (args->keep_stats)
+      args->started = started;
 
-      if (args->grid[i][j] && (neighbors < 2 || neighbors > 3))
-        args->out[i][j] = false;
-      else if (!args->grid[i][j] && neighbors == 3)
-        args->out[i][j] = true;
-      else
-        args->out[i][j] = args->grid[i][j];
-    }
+    args->stats = emptyStats();
+    Stats *stats = args->keep_stats ? &args->stats : NULL;
+    if (SCHEDULE == SCHEDULE_STEALING)
+      args->hash = steal_tiles(args, stats);
+    else if (args->tiles)
+      args->hash = updateTileRows(args->grid, args->out, args->tiles,
+                                  args->start_row, args->end_row, stats);
+    else if (ENGINE == ENGINE_ROWSUM)
+      args->hash = updateRowsRowSum(args->grid, args->out, args->start_row,
+                                    args->end_row, stats);
+    else if (ENGINE == ENGINE_INPLACE)
+      args->hash = updateRowsInPlace(args->grid, args->start_row,
+                                     args->end_row, args->above, args->below,
+                                     stats);
+    else
+      args->hash = updateRows(args->grid, args->out, args->start_row,
+                              args->end_row, stats);
+
+    const int64_t finished = now_ns();
+    if (SCHEDULE != SCHEDULE_STEALING)
+      args->busy += finished - started;
+    if (args->keep_stats)
+      args->finished = finished;
+    waitBarrier(&pool->done);
   }
+  return NULL;
+}
 
-  pthread_exit(NULL);
+// rows [start, end) of band i of n over rows rows, the larger bands first
+static void band_rows(int rows, int n, int i, int *start, int *end) {
+  const int extra = rows % n;
+  *start = i * (rows / n) + (i < extra ? i : extra);
+  *end = *start + rows / n + (i < extra);
 }
 
-// Parallelized updateGrid function
-void parallelUpdateGrid(type **grid, int rows, int cols, type **out, int num_threads) {
-  pthread_t threads[num_threads];
-  ThreadArgs threadArgs[num_threads];
+// starts num_threads workers, idle until the first parallelUpdateGrid; set
+// up in place since the workers keep a pointer to the pool. tasks is the
+// number of tiles, which SCHEDULE_STEALING deals out.
+void createPool(Pool *pool, int num_threads, int cols, long tasks) {
+  pool->num_threads = num_threads;
+  pool->quit = false;
+  pool->threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  pool->args = (ThreadArgs *)calloc(num_threads, sizeof(ThreadArgs));
+  pool->edges = ENGINE == ENGINE_INPLACE
+                    ? (type *)malloc(2 * (size_t)num_threads * (cols + 2) *
+                                     sizeof(type))
+                    : NULL;
+  initBarrier(&pool->start, num_threads + 1);
+  initBarrier(&pool->done, num_threads + 1);
+  pool->latency = (Latency){0, 0};
+  pool->deques = NULL;
+  if (SCHEDULE == SCHEDULE_STEALING) {
+    pool->deques = (Deque *)aligned_alloc(64, num_threads * sizeof(Deque));
+    for (int i = 0; i < num_threads; i++)
+      initDeque(&pool->deques[i], (tasks + num_threads - 1) / num_threads);
+  }
+  atomic_init(&pool->remaining, 0);
+  atomic_init(&pool->sleepers, 0);
+  for (int i = 0; i < num_threads; i++) {
+    pool->args[i].pool = pool;
+    pool->args[i].thread_num = i;
+    pool->args[i].victim = i;
+    pool->args[i].spin = SPIN_MIN;
+    pthread_attr_t attr;
+    pinned_attr(&attr, i);
+    pthread_create(&pool->threads[i], &attr, updateGridThread,
+                   (void *)&pool->args[i]);
+    pthread_attr_destroy(&attr);
+  }
+}
+
+void freePool(Pool *pool) {
+  pool->quit = true;
+  waitBarrier(&pool->start);
+  for (int i = 0; i < pool->num_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+  freeBarrier(&pool->start);
+  freeBarrier(&pool->done);
+  free(pool->threads);
+  free(pool->args);
+  free(pool->edges);
+  for (int i = 0; pool->deques && i < pool->num_threads; i++)
+    freeDeque(&pool->deques[i]);
+  free(pool->deques);
+}
+
+// prints each thread's time spent updating and, when stealing, its steals
+void reportBalance(Pool *pool) {
+  int64_t total = 0, most = 0;
+  printf("Busy ms per thread:");
+  for (int i = 0; i < pool->num_threads; i++) {
+    const int64_t busy = pool->args[i].busy;
+    printf(" %.1f", busy / 1e6);
+    total += busy;
+    most = busy > most ? busy : most;
+  }
+  printf("\nBusiest thread over the mean: %.2f\n",
+         total ? (double)most * pool->num_threads / total : 0);
+  if (SCHEDULE != SCHEDULE_STEALING)
+    return;
+  long steals = 0;
+  printf("Steals per thread:");
+  for (int i = 0; i < pool->num_threads; i++) {
+    printf(" %ld", pool->args[i].steals);
+    steals += pool->args[i].steals;
+  }
+  printf("\nSteals: %ld\n", steals);
+}
 
-  int rows_per_thread = rows / num_threads;
-  int remaining_rows = rows % num_threads;
-  int current_row = 0;
+// Parallelized updateGrid function
+// returns the hash of the new generation, and its stats unless stats is NULL
+uint64_t parallelUpdateGrid(Pool *pool, Grid *grid, Grid *out, Tiles *tiles,
+                            Stats *stats) {
+  const int num_threads = pool->num_threads;
+  ThreadArgs *threadArgs = pool->args;
 
+  // with tiles, threads split whole tile rows, or single tiles to steal
+  int rows = tiles ? tiles->rows : grid->rows;
+  if (SCHEDULE == SCHEDULE_STEALING) {
+    rows = tiles->rows * tiles->cols;
+    atomic_store(&pool->remaining, rows);
+  }
   for (int i = 0; i < num_threads; i++) {
     threadArgs[i].grid = grid;
-    threadArgs[i].rows = rows;
-    threadArgs[i].cols = cols;
     threadArgs[i].out = out;
-    threadArgs[i].start_row = current_row;
-    threadArgs[i].end_row = current_row + rows_per_thread + (i < remaining_rows ? 1 : 0);
-    threadArgs[i].thread_num = i;
+    threadArgs[i].tiles = tiles;
+    band_rows(rows, num_threads, i, &threadArgs[i].start_row,
+              &threadArgs[i].end_row);
+    threadArgs[i].keep_stats = stats != NULL;
+  }
 
-    pthread_create(&threads[i], NULL, updateGridThread, (void *)&threadArgs[i]);
+  // in place, a band's neighbours overwrite the rows around it, so those are
+  // copied before any thread starts
+  if (ENGINE == ENGINE_INPLACE) {
+    const int width = grid->cols + 2;
+    for (int i = 0; i < num_threads; i++) {
+      type *above = pool->edges + 2 * (size_t)i * width, *below = above + width;
+      memcpy(above, &CELL(grid, threadArgs[i].start_row - 1, -1),
+             width * sizeof(type));
+      memcpy(below, &CELL(grid, threadArgs[i].end_row, -1),
+             width * sizeof(type));
+      threadArgs[i].above = above + 1;
+      threadArgs[i].below = below + 1;
+    }
+  }
+
+  const int64_t released = stats ? now_ns() : 0;
+  waitBarrier(&pool->start);
+  waitBarrier(&pool->done);
+  const int64_t resumed = stats ? now_ns() : 0;
+
+  uint64_t hash = 0;
+  int64_t started = released, finished = released;
+  for (int i = 0; i < num_threads; i++) {
+    hash += threadArgs[i].hash;
+    if (stats) {
+      mergeStats(stats, &threadArgs[i].stats);
+      started = threadArgs[i].started > started ? threadArgs[i].started
+                                                : started;
+      finished = threadArgs[i].finished > finished ? threadArgs[i].finished
+                                                   : finished;
+    }
+  }
+  if (stats)
+    pool->latency = (Latency){(started - released) / 1e3,
+                              (resumed - finished) / 1e3};
+
+  if (tiles)
+    swapTiles(tiles);
+  return hash;
+}
+
+// Seeded, counter-based initial cells: cell n, counting row-major over the
+// whole grid, is alive when byte n % 8 of mix64(key + n / 8) is below
+// density * 256. Any thread or rank can draw any run of cells, and a seed
+// gives the same grid however the work is split.
+#ifndef SEED
+#define SEED 1
+#endif
+
+#ifndef DENSITY
+#define DENSITY 0.5 // of live cells, in steps of 1/256
+#endif
+
+static inline type random_cell(uint64_t key, uint64_t n, unsigned threshold) {
+  return (mix64(key + n / 8) >> n % 8 * 8 & 0xff) < threshold;
+}
+
+// cells [0, count) of dst become cells [n, n + count) of the grid
+void randomCells(type *dst, uint64_t n, size_t count, uint64_t seed,
+                 double density) {
+  const uint64_t key = mix64(seed);
+  const unsigned threshold = (unsigned)(density * 256 + 0.5);
+  size_t k = 0;
+  for (; k < count && (n + k) % 8; k++)
+    dst[k] = random_cell(key, n + k, threshold);
+  // one hash per 8 cells
+  for (; k + 8 <= count; k += 8) {
+    const uint64_t bits = mix64(key + (n + k) / 8);
+    for (int b = 0; b < 8; b++)
+      dst[k + b] = (bits >> 8 * b & 0xff) < threshold;
+  }
+  for (; k < count; k++)
+    dst[k] = random_cell(key, n + k, threshold);
+}
+
+// Grid memory is mapped directly: 1 GB or 2 MB pages when the grid spans at
+// least one and the kernel has them reserved (vm.nr_hugepages), otherwise
+// normal pages with transparent huge pages asked for. Nothing is written
+// here, so each page lands on the NUMA node of the thread that first touches
+// it, which touchGrid arranges to be the thread that updates it.
+#ifndef HUGE_PAGES
+#define HUGE_PAGES 1 // 0 for normal pages only
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// maps at least *bytes, and returns the size mapped and of its pages
+static void *map_cells(size_t *bytes, size_t *page) {
+  const int shifts[] = {30, 21};
+  for (int k = 0; HUGE_PAGES && k < 2; k++) {
+    const size_t size = (size_t)1 << shifts[k];
+    if (*bytes < size)
+      continue;
+    const size_t rounded = (*bytes + size - 1) / size * size;
+    void *block = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                           shifts[k] << MAP_HUGE_SHIFT,
+                       -1, 0);
+    if (block != MAP_FAILED) {
+      *bytes = rounded;
+      *page = size;
+      return block;
+    }
+  }
 
-    current_row = threadArgs[i].end_row;
+  *page = sysconf(_SC_PAGESIZE);
+  *bytes = (*bytes + *page - 1) / *page * *page;
+  void *block = mmap(NULL, *bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
   }
+#if HUGE_PAGES && defined(MADV_HUGEPAGE)
+  madvise(block, *bytes, MADV_HUGEPAGE);
+#endif
+  return block;
+}
+
+typedef struct {
+  Grid *grid;
+  int start, end; // rows, the border rows belong to the first and last band
+  uint64_t seed;
+  double density; // of the random cells drawn, 0 for none
+} TouchArgs;
+
+// the rows [start, end) of band i as parallelUpdateGrid hands them out, in
+// units of unit rows
+static void touch_rows(Grid *grid, int num_threads, int unit, int i,
+                       int *start, int *end) {
+  band_rows((grid->rows + unit - 1) / unit, num_threads, i, start, end);
+  *start = *start * unit < grid->rows ? *start * unit : grid->rows;
+  *end = *end * unit < grid->rows ? *end * unit : grid->rows;
+}
 
+static void *touch_band(void *arguments) {
+  TouchArgs *args = (TouchArgs *)arguments;
+  Grid *grid = args->grid;
+  memset(&CELL(grid, args->start, -1), 0,
+         (size_t)(args->end - args->start) * grid->stride * sizeof(type));
+  if (args->density > 0)
+    for (int i = args->start > 0 ? args->start : 0;
+         i < args->end && i < grid->rows; i++)
+      randomCells(&CELL(grid, i, 0), (uint64_t)i * grid->cols, grid->cols,
+                  args->seed, args->density);
+  return NULL;
+}
+
+// zeroes each band of the grid from its own thread, then draws its cells
+// unless density is 0
+void touchGrid(Grid *grid, int num_threads, int unit, uint64_t seed,
+               double density) {
+  pthread_t threads[num_threads];
+  TouchArgs args[num_threads];
   for (int i = 0; i < num_threads; i++) {
-    pthread_join(threads[i], NULL);
+    args[i].grid = grid;
+    args[i].seed = seed;
+    args[i].density = density;
+    touch_rows(grid, num_threads, unit, i, &args[i].start, &args[i].end);
+    if (i == 0)
+      args[i].start = -1;
+    if (i == num_threads - 1)
+      args[i].end = grid->rows + 1;
+    pthread_attr_t attr;
+    pinned_attr(&attr, i);
+    pthread_create(&threads[i], &attr, touch_band, (void *)&args[i]);
+    pthread_attr_destroy(&attr);
   }
+  for (int i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
 }
 
-type **createGrid(int rows, int cols, bool random) {
-  type **grid = (type **)malloc(rows * sizeof(type *));
-  for (int i = 0; i < rows; i++) {
-    grid[i] = (type *)malloc(cols * sizeof(type));
-    for (int j = 0; j < cols; j++)
-      grid[i][j] = random ? rand() % 2 : false;
+#define MAX_NODES 64
+
+// prints how many of the grid's pages each NUMA node holds, and the node
+// holding most of each thread's band
+void reportPlacement(Grid *grid, int num_threads, int unit) {
+  long per_node[MAX_NODES] = {0};
+  int homes[num_threads];
+  uintptr_t counted = 0; // pages below were counted with an earlier band
+  for (int i = 0; i < num_threads; i++) {
+    int start, end;
+    touch_rows(grid, num_threads, unit, i, &start, &end);
+    long band[MAX_NODES] = {0};
+    uintptr_t from = (uintptr_t)&CELL(grid, start, -1) / grid->page;
+    from *= grid->page;
+    const uintptr_t to = (uintptr_t)&CELL(grid, end, -1);
+    while (from < to) {
+      void *pages[256];
+      int status[256];
+      int n = 0;
+      for (; n < 256 && from < to; n++, from += grid->page)
+        pages[n] = (void *)from;
+      if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) {
+        printf("Page placement unknown: %s\n", strerror(errno));
+        return;
+      }
+      for (int k = 0; k < n; k++)
+        if (status[k] >= 0 && status[k] < MAX_NODES) {
+          band[status[k]]++;
+          per_node[status[k]] += (uintptr_t)pages[k] >= counted;
+        }
+    }
+    counted = from > counted ? from : counted;
+    homes[i] = -1;
+    for (int node = 0; node < MAX_NODES; node++)
+      if (band[node] && (homes[i] < 0 || band[node] > band[homes[i]]))
+        homes[i] = node;
   }
-  return grid;
+
+  printf("Pages of %zu KB per node:", grid->page >> 10);
+  for (int node = 0; node < MAX_NODES; node++)
+    if (per_node[node])
+      printf(" %d: %ld", node, per_node[node]);
+  printf("\nNode of each thread's band:");
+  for (int i = 0; i < num_threads; i++)
+    printf(" %d", homes[i]);
+  printf("\n");
 }
 
-void freeGrid(type **grid, int rows) {
-  for (int i = 0; i < rows; i++)
-    free(grid[i]);
-  free(grid);
+// stride is in cells, 0 picks cols + 2 rounded up to GRID_ALIGN bytes
+Grid createGrid(int rows, int cols, int stride) {
+  const int per_line = GRID_ALIGN / sizeof(type);
+  if (stride < cols + 2)
+    stride = (cols + 2 + per_line - 1) / per_line * per_line;
+
+  Grid grid;
+  grid.rows = rows;
+  grid.cols = cols;
+  grid.stride = stride;
+  grid.bytes = (size_t)(rows + 2) * stride * sizeof(type) + GRID_ALIGN;
+  grid.block = map_cells(&grid.bytes, &grid.page);
+  // align cell (0, 0) so every row starts on a GRID_ALIGN boundary when the
+  // stride is a multiple of it
+  uintptr_t first = (uintptr_t)grid.block + (stride + 1) * sizeof(type);
+  uintptr_t pad = (GRID_ALIGN - first % GRID_ALIGN) % GRID_ALIGN;
+  grid.cells = (type *)(first + pad);
+
+  return grid;
 }
 
-void swap(type ***a, type ***b) {
-  type **tmp = *a;
+void freeGrid(Grid *grid) { munmap(grid->block, grid->bytes); }
+
+void swap(Grid *a, Grid *b) {
+  Grid tmp = *a;
   *a = *b;
   *b = tmp;
 }
 
-void draw2file(type **grid, int step, unsigned char *data) {
-  for (int i = 0; i < ROWS * SCALE; i++)
-    for (int j = 0; j < COLS * SCALE; j++) {
-      unsigned char color = grid[i / SCALE][j / SCALE] * 255;
-      int index = (i * COLS * SCALE + j) * 3;
+// wraps rows [start, end): their ghost cells, and the ghost row past the
+// opposite edge when they hold the first or the last row
+void wrapRows(Grid *grid, int start, int end) {
+  for (int i = start; i < end; i++) {
+    CELL(grid, i, -1) = CELL(grid, i, grid->cols - 1);
+    CELL(grid, i, grid->cols) = CELL(grid, i, 0);
+  }
+  if (end == grid->rows)
+    memcpy(&CELL(grid, -1, -1), &CELL(grid, grid->rows - 1, -1),
+           (grid->cols + 2) * sizeof(type));
+  if (start == 0)
+    memcpy(&CELL(grid, grid->rows, -1), &CELL(grid, 0, -1),
+           (grid->cols + 2) * sizeof(type));
+}
+
+// Copies the opposite edges into the ghost border, corners included, once
+// per generation, so the kernels wrap around without any index arithmetic.
+void wrapGrid(Grid *grid) { wrapRows(grid, 0, grid->rows); }
+
+// Wavefront: no barrier between generations. Each band publishes the number
+// of the last generation it wrote, and computes generation t + 1 as soon as
+// the bands above and below it have published t, so it waits on its
+// neighbours instead of on the slowest thread. Generation t lives in grid
+// t % WAVE_BUFFERS; a grid is reused once the caller has drawn the generation
+// it held, so the fastest band runs at most WAVE_AHEAD generations ahead of
+// the slowest.
+#ifndef WAVE_AHEAD
+#define WAVE_AHEAD 3
+#endif
+#define WAVE_BUFFERS (WAVE_AHEAD + 1)
+
+// Set in every counter when the caller stops early. It is part of the futex
+// word, so no sleeper misses it, and reads as a generation past any other.
+#define WAVE_QUIT (1 << 30)
+
+// A generation number, one per cache line so that bands do not share one
+typedef struct {
+  _Alignas(64) atomic_int value;
+  atomic_int sleepers; // threads asleep on value
+} Counter;
+
+static void wake_counter(Counter *counter) {
+  if (atomic_load(&counter->sleepers))
+    futex(&counter->value, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+static void publish(Counter *counter) {
+  atomic_fetch_add(&counter->value, 1);
+  wake_counter(counter);
+}
+
+// Waits until counter reaches generation, spinning for up to *spin pauses
+// and then sleeping on it; *spin adapts as in waitBarrier. False once the
+// caller has stopped.
+static bool await_counter(Counter *counter, int generation, int *spin) {
+  int seen = atomic_load_explicit(&counter->value, memory_order_acquire);
+  if (seen >= generation)
+    return !(seen & WAVE_QUIT);
+  for (int k = 0; k < *spin; k++) {
+    cpu_pause();
+    seen = atomic_load_explicit(&counter->value, memory_order_acquire);
+    if (seen >= generation) {
+      if (*spin < SPIN_MAX)
+        *spin *= 2;
+      return !(seen & WAVE_QUIT);
+    }
+  }
+  if (*spin > SPIN_MIN)
+    *spin /= 2;
+
+  atomic_fetch_add(&counter->sleepers, 1);
+  while ((seen = atomic_load(&counter->value)) < generation)
+    futex(&counter->value, FUTEX_WAIT_PRIVATE, seen);
+  atomic_fetch_sub(&counter->sleepers, 1);
+  return !(seen & WAVE_QUIT);
+}
+
+typedef struct Wave Wave;
+
+// A band and what it found in the generations still held, by grid
+typedef struct {
+  Wave *wave;
+  int band;
+  int start_row;
+  int end_row;
+  uint64_t hash[WAVE_BUFFERS];
+  Stats stats[WAVE_BUFFERS];      // when stats are kept
+  int64_t stalled[WAVE_BUFFERS]; // ns waited on the neighbours, likewise
+} WaveBand;
+
+struct Wave {
+  Grid grids[WAVE_BUFFERS];
+  Counter *done;    // per band, the last generation it wrote
+  Counter consumed; // the last generation the caller is done with
+  WaveBand *bands;
+  pthread_t *threads;
+  int num_bands;
+  int steps;
+  bool keep_stats;
+  int spin;        // of the caller
+  Latency latency; // of the last generation awaited
+};
+
+void *updateGridWave(void *arguments) {
+  WaveBand *band = (WaveBand *)arguments;
+  Wave *wave = band->wave;
+  const int n = wave->num_bands, b = band->band;
+#ifdef TORUS
+  const int up = (b + n - 1) % n, down = (b + 1) % n;
+#else
+  const int up = b > 0 ? b - 1 : b, down = b + 1 < n ? b + 1 : b;
+#endif
+  int spin = SPIN_MIN;
+
+  for (int t = 0; t < wave->steps; t++) {
+    const int64_t waiting = wave->keep_stats ? now_ns() : 0;
+    // the grid written last held generation t + 1 - WAVE_BUFFERS, which the
+    // neighbours are past once they hold t
+    if (!await_counter(&wave->consumed, t + 1 - WAVE_BUFFERS, &spin) ||
+        !await_counter(&wave->done[up], t, &spin) ||
+        !await_counter(&wave->done[down], t, &spin))
+      break;
+
+    const int slot = (t + 1) % WAVE_BUFFERS;
+    Grid *grid = &wave->grids[t % WAVE_BUFFERS], *out = &wave->grids[slot];
+    Stats *stats = NULL;
+    if (wave->keep_stats) {
+      band->stalled[slot] = now_ns() - waiting;
+      band->stats[slot] = emptyStats();
+      stats = &band->stats[slot];
+    }
+    if (ENGINE == ENGINE_ROWSUM)
+      band->hash[slot] = updateRowsRowSum(grid, out, band->start_row,
+                                          band->end_row, stats);
+    else
+      band->hash[slot] =
+          updateRows(grid, out, band->start_row, band->end_row, stats);
+#ifdef TORUS
+    wrapRows(out, band->start_row, band->end_row);
+#endif
+    publish(&wave->done[b]);
+  }
+  return NULL;
+}
+
+// Starts one thread per band on generation 0, in grid; out and
+// WAVE_BUFFERS - 2 more grids hold the generations after it. The threads run
+// up to generation steps unless stopWave comes first.
+void startWave(Wave *wave, Grid *grid, Grid *out, int num_threads, int steps,
+               bool keep_stats) {
+  // an empty band would leave its neighbours reading each other's rows
+  const int n = num_threads < grid->rows ? num_threads : grid->rows;
+  wave->grids[0] = *grid;
+  wave->grids[1] = *out;
+  for (int k = 2; k < WAVE_BUFFERS; k++) {
+    wave->grids[k] = createGrid(grid->rows, grid->cols, grid->stride);
+    touchGrid(&wave->grids[k], n, 1, 0, 0);
+  }
+  wave->num_bands = n;
+  wave->steps = steps < WAVE_QUIT ? steps : WAVE_QUIT - 1;
+  wave->keep_stats = keep_stats;
+  wave->spin = SPIN_MIN;
+  wave->latency = (Latency){0, 0};
+  wave->done = (Counter *)aligned_alloc(64, n * sizeof(Counter));
+  atomic_init(&wave->consumed.value, 0);
+  atomic_init(&wave->consumed.sleepers, 0);
+  wave->bands = (WaveBand *)calloc(n, sizeof(WaveBand));
+  wave->threads = (pthread_t *)malloc(n * sizeof(pthread_t));
+  for (int b = 0; b < n; b++) {
+    atomic_init(&wave->done[b].value, 0);
+    atomic_init(&wave->done[b].sleepers, 0);
+    wave->bands[b].wave = wave;
+    wave->bands[b].band = b;
+    band_rows(grid->rows, n, b, &wave->bands[b].start_row,
+              &wave->bands[b].end_row);
+  }
+  for (int b = 0; b < n; b++) {
+    pthread_attr_t attr;
+    pinned_attr(&attr, b);
+    pthread_create(&wave->threads[b], &attr, updateGridWave,
+                   (void *)&wave->bands[b]);
+    pthread_attr_destroy(&attr);
+  }
+}
+
+// Waits for every band to write generation, and returns the grid holding it.
+// *hash gets its hash, and stats its stats unless NULL; the latency is then
+// the longest a band waited on its neighbours for it and how long the caller
+// waited for the last band.
+Grid *awaitGeneration(Wave *wave, int generation, uint64_t *hash,
+                      Stats *stats) {
+  const int slot = generation % WAVE_BUFFERS;
+  const int64_t waiting = stats ? now_ns() : 0;
+  for (int b = 0; b < wave->num_bands; b++)
+    await_counter(&wave->done[b], generation, &wave->spin);
+
+  *hash = 0;
+  int64_t stalled = 0;
+  for (int b = 0; b < wave->num_bands; b++) {
+    *hash += wave->bands[b].hash[slot];
+    if (stats) {
+      mergeStats(stats, &wave->bands[b].stats[slot]);
+      stalled = wave->bands[b].stalled[slot] > stalled
+                    ? wave->bands[b].stalled[slot]
+                    : stalled;
+    }
+  }
+  if (stats)
+    wave->latency = (Latency){stalled / 1e3, (now_ns() - waiting) / 1e3};
+  return &wave->grids[slot];
+}
+
+// the caller is done with the generation awaited last, whose grid the bands
+// may now write again
+void releaseGeneration(Wave *wave) { publish(&wave->consumed); }
+
+// stops the bands wherever they are and frees all but grid and out
+void stopWave(Wave *wave) {
+  atomic_fetch_or(&wave->consumed.value, WAVE_QUIT);
+  wake_counter(&wave->consumed);
+  for (int b = 0; b < wave->num_bands; b++) {
+    atomic_fetch_or(&wave->done[b].value, WAVE_QUIT);
+    wake_counter(&wave->done[b]);
+  }
+  for (int b = 0; b < wave->num_bands; b++)
+    pthread_join(wave->threads[b], NULL);
+  for (int k = 2; k < WAVE_BUFFERS; k++)
+    freeGrid(&wave->grids[k]);
+  free(wave->done);
+  free(wave->bands);
+  free(wave->threads);
+}
+
+// one CSV line per generation, fully buffered
+FILE *openStats(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  setvbuf(file, NULL, _IOFBF, 1 << 20);
+  // the wavefront has no barriers, and times its own waits (see Latency)
+  fprintf(file,
+          "generation,population,births,deaths,top,left,bottom,right,%s\n",
+          SCHEDULE == SCHEDULE_WAVEFRONT ? "neighbor_wait_us,consume_wait_us"
+                                         : "start_us,done_us");
+  return file;
+}
+
+void writeStats(FILE *file, int generation, Stats *stats,
+                const Latency *latency) {
+  const bool empty = stats->top > stats->bottom;
+  fprintf(file, "%d,%llu,%llu,%llu,%d,%d,%d,%d,%.2f,%.2f\n", generation,
+          (unsigned long long)stats->population,
+          (unsigned long long)stats->births,
+          (unsigned long long)stats->deaths, empty ? -1 : stats->top,
+          empty ? -1 : stats->left, empty ? -1 : stats->bottom,
+          empty ? -1 : stats->right, latency->start, latency->done);
+}
+
+// Run-time settings. The macros above are the defaults, overridden by
+// --rows/--cols/--steps/--scale/--threads/--seed/--density/--rule on the
+// command line or by "key value" or "key = value" lines in a --config file
+// ('#' comments).
+typedef struct {
+  int rows, cols, steps, scale, threads;
+  uint64_t seed;
+  double density;
+  const char *rule;
+} Config;
+
+Config config = {ROWS, COLS, MAX_STEPS, SCALE, THREADS, SEED, DENSITY, RULE};
+
+static bool set_option(Config *c, const char *key, const char *value) {
+  if (strcmp(key, "rule") == 0) {
+    c->rule = strdup(value);
+    return c->rule != NULL;
+  }
+  char *end;
+  errno = 0;
+  if (strcmp(key, "seed") == 0) {
+    c->seed = strtoull(value, &end, 0);
+    return end != value && !*end && !errno;
+  }
+  if (strcmp(key, "density") == 0) {
+    c->density = strtod(value, &end);
+    return end != value && !*end && c->density >= 0 && c->density <= 1;
+  }
+  int *field = strcmp(key, "rows") == 0    ? &c->rows
+               : strcmp(key, "cols") == 0  ? &c->cols
+               : strcmp(key, "steps") == 0 ? &c->steps
+               : strcmp(key, "scale") == 0 ? &c->scale
+                   : strcmp(key, "threads") == 0 ? &c->threads
+                                           : NULL;
+  long n = field ? strtol(value, &end, 10) : 0;
+  // --threads 0 is the default, one thread per core
+  if (!field || end == value || *end || errno || n < (field != &c->threads) ||
+      n > INT_MAX)
+    return false;
+  *field = (int)n;
+  return true;
+}
+
+bool loadConfig(const char *path, Config *c) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+  char line[256], key[64], value[192];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "#\n")] = '\0';
+    for (char *p = line; *p; p++)
+      if (*p == '=')
+        *p = ' ';
+    int fields = sscanf(line, "%63s %191s", key, value);
+    ok = fields <= 0 || (fields == 2 && set_option(c, key, value));
+  }
+  fclose(file);
+  return ok;
+}
+
+// --key value pairs, applied in order so later ones win
+bool parseArgs(int argc, char **argv, Config *c) {
+  for (int a = 1; a < argc; a += 2) {
+    const char *key = argv[a], *value = a + 1 < argc ? argv[a + 1] : NULL;
+    bool ok = value && strncmp(key, "--", 2) == 0 &&
+              (strcmp(key, "--config") == 0 ? loadConfig(value, c)
+                                            : set_option(c, key + 2, value));
+    if (!ok) {
+      fprintf(stderr, "Invalid option: %s %s\n", key, value ? value : "");
+      return false;
+    }
+  }
+  return true;
+}
+
+void draw2file(Grid *grid, int step, unsigned char *data) {
+  const int scale = config.scale, width = config.cols * scale;
+  for (int i = 0; i < config.rows * scale; i++)
+    for (int j = 0; j < width; j++) {
+      unsigned char color = CELL(grid, i / scale, j / scale) * 255;
+      size_t index = ((size_t)i * width + j) * 3;
       data[index + 0] = color;
       data[index + 1] = color;
       data[index + 2] = color;
@@ -146,8 +1999,7 @@ void draw2file(type **grid, int step, unsigned char *data) {
 
   char filename[100];
   sprintf(filename, "out/%d.png", step);
-  stbi_write_png(filename, COLS * SCALE, ROWS * SCALE, 3, data,
-                 COLS * SCALE * 3);
+  stbi_write_png(filename, width, config.rows * scale, 3, data, width * 3);
 }
 
 // #define FFMPEG_PATH "out/ffmpeg.exe"
@@ -175,22 +2027,100 @@ void render() {
 
 int main(int argc, char **argv) {
   signal(SIGINT, sigint_handler);
-  type **grid = createGrid(ROWS, COLS, true);
-  type **out = createGrid(ROWS, COLS, false);
+  if (!parseArgs(argc, argv, &config))
+    return 1;
+  if (!parseRule(config.rule, &rule)) {
+    fprintf(stderr, "Invalid rule: %s\n", config.rule);
+    return 1;
+  }
+  printf("Kernel: %s\n", selectRowKernel());
+  cpu_set_t mask;
+  sched_getaffinity(0, sizeof(mask), &mask);
+  const int cores = placeThreads(&mask, 0, 1);
+  if (!config.threads)
+    config.threads = cores;
+  printf("Threads: %d on %d CPUs\n", config.threads, num_cpus);
+  if (config.threads > num_cpus)
+    printf("More threads than CPUs: they will take turns\n");
+  Grid grid = createGrid(config.rows, config.cols, 0);
+  // updating in place needs no second grid
+  Grid out =
+      createGrid(ENGINE == ENGINE_INPLACE ? 0 : config.rows, config.cols, 0);
+  // each thread touches and draws the band it updates
+  const int unit = ENGINE == ENGINE_TILES ? TILE : 1;
+  touchGrid(&grid, config.threads, unit, config.seed, config.density);
+  touchGrid(&out, config.threads, unit, 0, 0);
+  reportPlacement(&grid, config.threads, unit);
 
-  const int size = ROWS * COLS * SCALE * SCALE * 3 * sizeof(unsigned char);
+  const size_t size = (size_t)config.rows * config.cols * config.scale *
+                      config.scale * 3 * sizeof(unsigned char);
   unsigned char *data = (unsigned char *)malloc(size);
 
-  for (int i = 0; i < MAX_STEPS && running; i++) {
+  Tiles tiles;
+  if (ENGINE == ENGINE_TILES)
+    tiles = createTiles(&grid);
+
+  History history = {{0}};
+  FILE *stats_file = NULL;
+#ifdef STATS
+  stats_file = openStats(STATS_FILE);
+#endif
+  Pool pool;
+  Wave wave;
+  if (SCHEDULE == SCHEDULE_WAVEFRONT) {
+#ifdef TORUS
+    wrapGrid(&grid); // the bands wrap the rows they write from then on
+#endif
+    startWave(&wave, &grid, &out, config.threads, config.steps,
+              stats_file != NULL);
+  } else
+    createPool(&pool, config.threads, config.cols,
+               ENGINE == ENGINE_TILES ? (long)tiles.rows * tiles.cols : 0);
+  const Latency *latency =
+      SCHEDULE == SCHEDULE_WAVEFRONT ? &wave.latency : &pool.latency;
+
+  for (int i = 0; i < config.steps && running; i++) {
     printf("\n_________________ROUND %d_________________\n", i);
-    // updateGrid(grid, ROWS, COLS, out);
-    parallelUpdateGrid(grid, ROWS, COLS, out, 30);
-    swap(&grid, &out);
-    draw2file(grid, i, data);
+    // updateGrid(&grid, &out);
+    Stats stats = emptyStats();
+    uint64_t hash;
+    if (SCHEDULE == SCHEDULE_WAVEFRONT) {
+      Grid *now = awaitGeneration(&wave, i + 1, &hash,
+                                  stats_file ? &stats : NULL);
+      draw2file(now, i, data);
+      releaseGeneration(&wave);
+    } else {
+#ifdef TORUS
+      wrapGrid(&grid); // before the threads start, so they all see it
+#endif
+      hash = parallelUpdateGrid(&pool, &grid, &out,
+                                ENGINE == ENGINE_TILES ? &tiles : NULL,
+                                stats_file ? &stats : NULL);
+      if (ENGINE != ENGINE_INPLACE)
+        swap(&grid, &out);
+      draw2file(&grid, i, data);
+    }
+    if (stats_file)
+      writeStats(stats_file, i + 1, &stats, latency);
+    const int period = checkCycle(&history, hash);
+    if (period) {
+      printf("Period %d from generation %d\n", period, i + 1 - period);
+      break;
+    }
   }
 
-  freeGrid(grid, ROWS);
-  freeGrid(out, ROWS);
+  if (SCHEDULE == SCHEDULE_WAVEFRONT)
+    stopWave(&wave);
+  else {
+    reportBalance(&pool);
+    freePool(&pool);
+  }
+  if (ENGINE == ENGINE_TILES)
+    freeTiles(&tiles);
+  if (stats_file)
+    fclose(stats_file);
+  freeGrid(&grid);
+  freeGrid(&out);
   free(data);
 
   render();